@@ -0,0 +1,183 @@
+// Template, IGAD version 3
+// Get the latest version from: https://github.com/jbikker/tmpl8
+// IGAD/NHTV/UU - Jacco Bikker - 2006-2023
+
+#include "precomp.h"
+#include "cloth.h"
+
+// general cloth mesh, see cloth.h
+ClothMesh::~ClothMesh()
+{
+	Free();
+}
+
+void ClothMesh::Free()
+{
+	FREE64( x ), FREE64( y ), FREE64( z ), FREE64( prevx ), FREE64( prevy ), FREE64( prevz ), FREE64( invMass );
+	FREE64( adjStart ), FREE64( adjEdge );
+	FREE64( ei ), FREE64( ej ), FREE64( rest ), FREE64( wi ), FREE64( wj ), FREE64( batchStart ), FREE64( batchFamily );
+	x = y = z = prevx = prevy = prevz = invMass = rest = wi = wj = 0;
+	adjStart = adjEdge = ei = ej = batchStart = batchFamily = 0;
+	vertexCount = slotCount = colors = 0;
+}
+
+void ClothMesh::Build( const float2* positions, const uint count, const Edge* edgeList, const uint edgeCount )
+{
+	Build( count, edgeList, edgeCount );
+	for (uint v = 0; v < count; v++) x[v] = prevx[v] = positions[v].x, y[v] = prevy[v] = positions[v].y;
+	is3D = false;
+}
+
+void ClothMesh::Build( const float3* positions, const uint count, const Edge* edgeList, const uint edgeCount )
+{
+	Build( count, edgeList, edgeCount );
+	for (uint v = 0; v < count; v++)
+	{
+		x[v] = prevx[v] = positions[v].x;
+		y[v] = prevy[v] = positions[v].y;
+		z[v] = prevz[v] = positions[v].z;
+	}
+	is3D = true;
+}
+
+void ClothMesh::Build( const uint count, const Edge* edgeList, const uint edgeCount )
+{
+	Free();
+	// vertices, padded to a multiple of eight; vertex 'count' is the scratch vertex
+	vertexCount = count;
+	const uint fieldSize = ((count + 8) & ~7) * sizeof( float );
+	float** fields[7] = { &x, &y, &z, &prevx, &prevy, &prevz, &invMass };
+	for (int f = 0; f < 7; f++) *fields[f] = (float*)MALLOC64( fieldSize ), memset( *fields[f], 0, fieldSize );
+	for (uint v = 0; v < count; v++) invMass[v] = 1;
+	// colour the edges of each family, visiting them by lowest vertex index: each
+	// edge takes the lowest colour that is not used yet at either of its end points
+	vector<uint> order( edgeCount ), color( edgeCount ), colorCount, colorFamily;
+	for (uint k = 0; k < edgeCount; k++) order[k] = k;
+	sort( order.begin(), order.end(), [edgeList]( const uint a, const uint b ) {
+		const Edge& ea = edgeList[a], &eb = edgeList[b];
+		if (ea.family != eb.family) return ea.family < eb.family;
+		const uint mina = min( ea.i, ea.j ), minb = min( eb.i, eb.j );
+		return mina != minb ? mina < minb : max( ea.i, ea.j ) < max( eb.i, eb.j );
+	} );
+	vector<uint64_t> used( count, 0 );
+	uint family = ~0u, firstColor = 0;
+	for (const uint k : order)
+	{
+		const Edge& e = edgeList[k];
+		FATALERROR_IF( e.i >= count || e.j >= count || e.i == e.j, "Invalid cloth edge %u: (%u, %u).", k, e.i, e.j );
+		FATALERROR_IF( e.family >= MAXFAMILIES, "Invalid family %u for cloth edge %u.", e.family, k );
+		if (e.family != family) family = e.family, firstColor = (uint)colorCount.size(), fill( used.begin(), used.end(), 0 );
+		const uint64_t available = ~(used[e.i] | used[e.j]);
+		FATALERROR_IF( !available, "Cloth vertex %u or %u has too many edges to colour.", e.i, e.j );
+		uint c = 0;
+		while (!((available >> c) & 1)) c++;
+		used[e.i] |= 1ull << c, used[e.j] |= 1ull << c;
+		if (firstColor + c == colorCount.size()) colorCount.push_back( 0 ), colorFamily.push_back( family );
+		color[k] = firstColor + c, colorCount[firstColor + c]++;
+	}
+	// lay out the batches; slots start out as padding edges on the scratch vertex
+	colors = (uint)colorCount.size();
+	batchStart = (uint*)MALLOC64( (colors + 1) * sizeof( uint ) );
+	batchFamily = (uint*)MALLOC64( max( 1u, colors ) * sizeof( uint ) );
+	batchStart[0] = 0;
+	for (uint c = 0; c < colors; c++) batchStart[c + 1] = batchStart[c] + ((colorCount[c] + 7) & ~7), batchFamily[c] = colorFamily[c];
+	slotCount = batchStart[colors];
+	ei = (uint*)MALLOC64( slotCount * sizeof( uint ) ), ej = (uint*)MALLOC64( slotCount * sizeof( uint ) );
+	rest = (float*)MALLOC64( slotCount * sizeof( float ) );
+	wi = (float*)MALLOC64( slotCount * sizeof( float ) ), wj = (float*)MALLOC64( slotCount * sizeof( float ) );
+	for (uint s = 0; s < slotCount; s++) ei[s] = ej[s] = count, rest[s] = 1, wi[s] = wj[s] = 0;
+	vector<uint> next( batchStart, batchStart + colors );
+	for (const uint k : order)
+	{
+		const uint slot = next[color[k]]++;
+		ei[slot] = edgeList[k].i, ej[slot] = edgeList[k].j, rest[slot] = edgeList[k].rest;
+	}
+	// CSR adjacency over the edge slots
+	adjStart = (uint*)MALLOC64( (count + 1) * sizeof( uint ) );
+	adjEdge = (uint*)MALLOC64( max( 1u, edgeCount * 2 ) * sizeof( uint ) );
+	memset( adjStart, 0, (count + 1) * sizeof( uint ) );
+	for (uint s = 0; s < slotCount; s++) if (ei[s] != count) adjStart[ei[s] + 1]++, adjStart[ej[s] + 1]++;
+	for (uint v = 0; v < count; v++) adjStart[v + 1] += adjStart[v];
+	vector<uint> cursor( adjStart, adjStart + count );
+	for (uint s = 0; s < slotCount; s++) if (ei[s] != count) adjEdge[cursor[ei[s]]++] = s, adjEdge[cursor[ej[s]]++] = s, UpdateWeights( s );
+}
+
+void ClothMesh::SetFamily( const uint family, const float familyStiffness, const bool familyResistsCompression )
+{
+	FATALERROR_IF( family >= MAXFAMILIES, "Invalid cloth constraint family %u.", family );
+	stiffness[family] = familyStiffness;
+	resistCompression[family] = familyResistsCompression;
+}
+
+void ClothMesh::UpdateWeights( const uint slot )
+{
+	const float a = invMass[ei[slot]], b = invMass[ej[slot]], sum = a + b;
+	wi[slot] = sum > 0 ? a / sum : 0;
+	wj[slot] = sum > 0 ? b / sum : 0;
+}
+
+void ClothMesh::Pin( const uint v, const bool pinned )
+{
+	// only the edges around v change
+	invMass[v] = pinned ? 0.0f : 1.0f;
+	for (uint k = adjStart[v]; k < adjStart[v + 1]; k++) UpdateWeights( adjEdge[k] );
+}
+
+void ClothMesh::Integrate( const float3 gravity )
+{
+	// verlet integration, eight vertices at a time; pinned vertices stay put
+	const floatx8 gx( gravity.x ), gy( gravity.y ), gz( gravity.z ), zero( 0.0f );
+	for (uint v = 0; v < vertexCount; v += 8)
+	{
+		const floatx8 x8 = floatx8::Load( x + v ), y8 = floatx8::Load( y + v );
+		const maskx8 free = floatx8::Load( invMass + v ) > zero;
+		select( free, x8 + (x8 - floatx8::Load( prevx + v )) + gx, x8 ).Store( x + v );
+		select( free, y8 + ((y8 - floatx8::Load( prevy + v )) + gy), y8 ).Store( y + v );
+		x8.Store( prevx + v ), y8.Store( prevy + v );
+		if (!is3D) continue;
+		const floatx8 z8 = floatx8::Load( z + v );
+		select( free, z8 + (z8 - floatx8::Load( prevz + v )) + gz, z8 ).Store( z + v );
+		z8.Store( prevz + v );
+	}
+}
+
+void ClothMesh::Relax()
+{
+	// one pass over all batches, family by family
+	for (uint b = 0; b < colors; b++) if (is3D) RelaxBatch<true>( b ); else RelaxBatch<false>( b );
+}
+
+template <bool D3> void ClothMesh::RelaxBatch( const uint b )
+{
+	// edges in a batch share no vertices, so groups of eight can be gathered,
+	// corrected and scattered back in any order. The correction moves the end
+	// points to exactly the rest length; scaling d by (stretch - 1) alone, as the
+	// grid does, overshoots and diverges on links stretched beyond twice their rest length.
+	const uint family = batchFamily[b];
+	JobManager::GetJobManager()->ParallelFor( batchStart[b] / 8, batchStart[b + 1] / 8, 64, [this, family]( int first, int last, JobContext& ) {
+		const floatx8 one( 1.0f ), zero( 0.0f ), k( stiffness[family] ), limit( resistCompression[family] ? 0.0f : 1.0f );
+		for (int s = first * 8; s < last * 8; s += 8)
+		{
+			const uintx8 i = uintx8::Load( ei + s ), j = uintx8::Load( ej + s );
+			const floatx8 wa = floatx8::Load( wi + s ) * k, wb = floatx8::Load( wj + s ) * k;
+			if constexpr (D3)
+			{
+				const float3x8 p( gather( x, i ), gather( y, i ), gather( z, i ) ), q( gather( x, j ), gather( y, j ), gather( z, j ) ), d = q - p;
+				const floatx8 stretch = fast_length( d ) * fast_rcp( floatx8::Load( rest + s ) ); // zero for exploded vertices
+				const maskx8 active = (stretch > one) | ((stretch > limit) & (stretch < one));
+				const float3x8 c = select( active, d * ((stretch - one) * fast_rcp( stretch )), float3x8( zero, zero, zero ) );
+				scatter( x, i, fmadd( c.x, wa, p.x ) ), scatter( y, i, fmadd( c.y, wa, p.y ) ), scatter( z, i, fmadd( c.z, wa, p.z ) );
+				scatter( x, j, q.x - c.x * wb ), scatter( y, j, q.y - c.y * wb ), scatter( z, j, q.z - c.z * wb );
+			}
+			else
+			{
+				const float2x8 p( gather( x, i ), gather( y, i ) ), q( gather( x, j ), gather( y, j ) ), d = q - p;
+				const floatx8 stretch = fast_length( d ) * fast_rcp( floatx8::Load( rest + s ) ); // zero for exploded vertices
+				const maskx8 active = (stretch > one) | ((stretch > limit) & (stretch < one));
+				const float2x8 c = select( active, d * ((stretch - one) * fast_rcp( stretch )), float2x8( zero, zero ) );
+				scatter( x, i, fmadd( c.x, wa, p.x ) ), scatter( y, i, fmadd( c.y, wa, p.y ) );
+				scatter( x, j, q.x - c.x * wb ), scatter( y, j, q.y - c.y * wb );
+			}
+		}
+	} );
+}
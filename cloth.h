@@ -0,0 +1,60 @@
+// Template, IGAD version 3
+// Get the latest version from: https://github.com/jbikker/tmpl8
+// IGAD/NHTV/UU - Jacco Bikker - 2006-2023
+
+#pragma once
+
+namespace Tmpl8
+{
+
+// general cloth mesh
+// Verlet cloth built from an edge list, for garments, cutouts and other shapes
+// that do not fit the grid in game.cpp. Vertices are stored as SoA arrays; the
+// CSR adjacency lists the edges around each vertex. Build colours the edges
+// greedily, so that no two edges in a batch share a vertex, and sorts each
+// batch by vertex index for locality. Relax then solves a batch eight edges at
+// a time, split over the worker threads, without conflicts. Batches are padded
+// to a multiple of eight with edges on a scratch vertex. Vertices with zero
+// inverse mass are pinned.
+// Meshes built from float3 positions are simulated in 3D. Edges belong to one
+// of MAXFAMILIES constraint families (e.g. structural, shear, bending); each
+// family is coloured into batches of its own, with its own stiffness, and can
+// either only pull (the default) or also push when compressed.
+#define MAXFAMILIES 4
+class ClothMesh
+{
+public:
+	struct Edge { uint i, j; float rest; uint family; };
+	ClothMesh() = default;
+	ClothMesh( const ClothMesh& ) = delete; // owns its arrays
+	ClothMesh& operator=( const ClothMesh& ) = delete;
+	~ClothMesh();
+	void Build( const float2* positions, const uint vertexCount, const Edge* edgeList, const uint edgeCount );
+	void Build( const float3* positions, const uint vertexCount, const Edge* edgeList, const uint edgeCount );
+	void SetFamily( const uint family, const float stiffness, const bool resistCompression );
+	void Pin( const uint v, const bool pinned = true );
+	void Integrate( const float3 gravity );
+	void Integrate( const float2 gravity ) { Integrate( make_float3( gravity, 0 ) ); }
+	void Relax();
+	// vertex data; prev holds the position in the previous step. z is zero for 2D meshes.
+	float* x = 0, *y = 0, *z = 0, *prevx = 0, *prevy = 0, *prevz = 0, *invMass = 0;
+	uint vertexCount = 0;
+	bool is3D = false;
+	// CSR adjacency: the edges around vertex v are adjEdge[adjStart[v] .. adjStart[v + 1]), as edge slots
+	uint* adjStart = 0, *adjEdge = 0;
+	// edge slots in batch order; batch b is [batchStart[b], batchStart[b + 1]) and holds edges of
+	// batchFamily[b]. wi and wj are the shares of the correction taken by each end point.
+	uint* ei = 0, *ej = 0;
+	float* rest = 0, *wi = 0, *wj = 0;
+	uint* batchStart = 0, *batchFamily = 0;
+	uint slotCount = 0, colors = 0;
+	float stiffness[MAXFAMILIES] = { 1, 1, 1, 1 };
+	bool resistCompression[MAXFAMILIES] = {};
+private:
+	void Free();
+	void Build( const uint vertexCount, const Edge* edgeList, const uint edgeCount );
+	void UpdateWeights( const uint slot );
+	template <bool D3> void RelaxBatch( const uint b );
+};
+
+} // namespace Tmpl8
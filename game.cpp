@@ -1,13 +1,15 @@
 #include "precomp.h"
+#include "cloth.h"
 #include "game.h"
 
-#define GRIDSIZE 256
+#define DEFAULTGRIDSIZE 256
+#define MAXGRIDSIZE 4096
 
 // VERLET CLOTH SIMULATION DEMO
 // High-level concept: a grid consists of points, each connected to four 
 // neighbours. For a simulation step, the position of each point is affected
 // by its speed, expressed as (current position - previous position), a
-// constant gravity force downwards, and random impulses ("wind").
+// constant gravity force downwards, and a drifting wind field.
 // The final force is provided by the bonds between points, via the four
 // connections.
 // Together, this simple scheme yields a pretty convincing cloth simulation.
@@ -35,42 +37,377 @@
 // Note that the GPGPU tasks will benefit from the SIMD tasks.
 // Also note that your final grade will be capped at 10.
 
-struct Point
+// cloth modes; press M for the mesh cloth, 3 for the 3D cloth, I to integrate
+// the grid implicitly and L to simulate it at a varying level of detail
+enum { MODE_GRID = 0, MODE_MESH, MODE_3D, MODE_IMPLICIT, MODE_LOD };
+#define ALLMODES 31
+#define GRIDMODES (1 << MODE_GRID | 1 << MODE_IMPLICIT)	// modes that move the points of the grid arrays
+int mode = MODE_GRID;
+
+// cloth state, stored as separate arrays so the simulation can process eight
+// points at a time. Arrays are padded at both ends, so a kernel may safely read
+// one vector before the first or after the last point. The grid has gridSize x
+// gridSize points. Every array over the points is a GridField, which converts to
+// a plain pointer; fields register themselves, so that ResizeGrid can reallocate
+// all of them when the size changes. They start out zeroed. A field names the
+// modes that use it, and only exists while one of those is active: the solver
+// scratch of the implicit mode alone is 100 bytes per point.
+#define GRIDPAD 16
+int gridSize = DEFAULTGRIDSIZE;
+class GridArray
+{
+public:
+	static void ResizeAll() { for (GridArray* a : All()) a->Free(), a->Update(); }
+	static void ModeChanged() { for (GridArray* a : All()) a->Update(); }
+protected:
+	GridArray( const size_t size, const int used ) : elementSize( size ), modes( used ) { All().push_back( this ); }
+	static vector<GridArray*>& All() { static vector<GridArray*> arrays; return arrays; }
+	void Update() { if (modes & (1 << mode)) { if (!data) Allocate(); } else Free(); }
+	void Free() { if (data) FREE64( (char*)data - GRIDPAD * elementSize ), data = 0; }
+	void Allocate()
+	{
+		const size_t bytes = ((size_t)gridSize * gridSize + 2 * GRIDPAD) * elementSize;
+		char* field = (char*)MALLOC64( bytes );
+		FATALERROR_IF( !field, "Out of memory for a %i x %i cloth.", gridSize, gridSize );
+		memset( field, 0, bytes );
+		data = field + GRIDPAD * elementSize;
+	}
+	void* data = 0;
+	size_t elementSize;
+	int modes;	// bit per mode that uses the field
+};
+template <class T = float, int MODES = ALLMODES> class GridField : public GridArray
 {
-	float2 pos;				// current position of the point
-	float2 prev_pos;		// position of the point in the previous frame
-	float2 fix;				// stationary position; used for the top line of points
-	bool fixed;				// true if this is a point in the top line of the cloth
-	float restlength[4];	// initial distance to neighbours
+public:
+	GridField() : GridArray( sizeof( T ), MODES ) {}
+	operator T*() const { return (T*)data; }
 };
+GridField<> posx, posy;			// current positions
+GridField<> prevx, prevy;		// positions in the previous step
+float2 fixpos[MAXGRIDSIZE];		// stationary positions of the top line of points
+
+// links
+// Every point owns the link to its right neighbour and the link to the point
+// below it. A link is alive while its bit is set in 'links'; tearing clears the
+// bit, which is all the bookkeeping a torn link needs. Points on the left, right
+// and bottom edge are not linked to each other, so those bits start cleared.
+// Points also own two diagonal (shear) links and two links that skip a point
+// (bending); only the denser stencils solve those.
+#define LINK_RIGHT 1
+#define LINK_DOWN 2
+#define LINK_SHEAR 4		// to the point below and to the right
+#define LINK_SHEAR2 8		// to the point below and to the left
+#define LINK_BEND 16		// to the point two steps to the right
+#define LINK_BEND2 32		// to the point two steps down
+#define LINKTYPES 6
+#define SLACK 1.15f
+// the offset to the other end of each type of link; type t has bit 1 << t
+constexpr int linkdx[LINKTYPES] = { 1, 0, 1, -1, 2, 0 }, linkdy[LINKTYPES] = { 0, 1, 1, 1, 0, 2 };
+constexpr int LinkType( const int dx, const int dy )
+{
+	for (int t = 0; t < LINKTYPES; t++) if (linkdx[t] == dx && linkdy[t] == dy) return t;
+	return -1;
+}
+GridField<> restlength[LINKTYPES];	// initial length, plus slack
+GridField<uint> links;				// LINK_RIGHT | LINK_DOWN while intact
+atomic<uint> tornLinks = 0;
 
-// grid access convenience
-Point* pointGrid = new Point[GRIDSIZE * GRIDSIZE];
-Point& grid( const uint x, const uint y ) { return pointGrid[x + y * GRIDSIZE]; }
+// grid access convenience; kernels compiled for a fixed width W use Width<W>,
+// which folds to a constant, and reads gridSize for W = 0
+inline int idx( const int x, const int y ) { return x + y * gridSize; }
+template <int W> inline int Width() { return W > 0 ? W : gridSize; }
+template <int W> inline int Idx( const int x, const int y ) { return x + y * Width<W>(); }
+inline float2 position( const int x, const int y ) { return make_float2( posx[idx( x, y )], posy[idx( x, y )] ); }
+inline bool Linked( const int i, const int j )
+{
+	if (j == i + 1 || j == i - 1) return links[min( i, j )] & LINK_RIGHT;
+	if (j == i + gridSize || j == i - gridSize) return links[min( i, j )] & LINK_DOWN;
+	return false;
+}
 
-// grid offsets for the neighbours via the four links
-int xoffset[4] = { 1, -1, 0, 0 }, yoffset[4] = { 0, 0, 1, -1 };
+// obstacles
+// Shapes are stored in a BVH over their bounds. The integration kernel records
+// the bounds of each tile of TILESIZE x TILESIZE points, padded by TILEMARGIN
+// for movement during the constraint iterations. Collision then only visits
+// tiles whose bounds overlap an obstacle.
+#define TILESIZE 16
+#define TILES (gridSize / TILESIZE)
+#define MAXTILES (MAXGRIDSIZE / TILESIZE)
+#define TILEMARGIN 4.0f
+vector<Obstacle> obstacles;
+vector<aabb> obstacleBounds;
+BVH obstacleBVH;
+aabb tileBounds[MAXTILES * MAXTILES];
 
-// initialization
-void Game::Init() {
-	// create the cloth
-	for (int y = 0; y < GRIDSIZE; y++) for (int x = 0; x < GRIDSIZE; x++) {
-		grid( x, y ).pos.x = 10 + (float)x * ((SCRWIDTH - 100) / GRIDSIZE) + y * 0.9f + Rand( 2 );
-		grid( x, y ).pos.y = 10 + (float)y * ((SCRHEIGHT - 180) / GRIDSIZE) + Rand( 2 );
-		grid( x, y ).prev_pos = grid( x, y ).pos; // all points start stationary
-		if (y == 0) {
-			grid( x, y ).fixed = true;
-			grid( x, y ).fix = grid( x, y ).pos;
-		} else {
-			grid( x, y ).fixed = false;
+aabb Obstacle::Bounds() const
+{
+	if (type == BOX) return aabb( make_float3( a - b, 0 ), make_float3( a + b, 0 ) );
+	return aabb( make_float3( fminf( a, b ) - radius, 0 ), make_float3( fmaxf( a, b ) + radius, 0 ) );
+}
+void Game::AddObstacle( const Obstacle& obstacle )
+{
+	obstacles.push_back( obstacle );
+	obstacleBounds.push_back( obstacle.Bounds() );
+	obstacleBVH.Build( obstacleBounds.data(), (uint)obstacles.size() );
+}
+void Game::ClearObstacles()
+{
+	obstacles.clear();
+	obstacleBounds.clear();
+	obstacleBVH.Build( obstacleBounds.data(), 0 );
+}
+
+// move points inside an obstacle to the nearest point on its surface, eight at a time
+static float2x8 ProjectOut( const Obstacle& o, const float2x8& p )
+{
+	if (o.type == Obstacle::BOX)
+	{
+		// leave through the nearest side
+		const floatx8 lx = p.x - o.a.x, ly = p.y - o.a.y;
+		const floatx8 penx = floatx8( o.b.x ) - abs( lx ), peny = floatx8( o.b.y ) - abs( ly );
+		const maskx8 inside = (penx > floatx8( 0.0f )) & (peny > floatx8( 0.0f )), alongx = penx < peny;
+		const floatx8 sidex = select( lx < floatx8( 0.0f ), floatx8( o.a.x - o.b.x ), floatx8( o.a.x + o.b.x ) );
+		const floatx8 sidey = select( ly < floatx8( 0.0f ), floatx8( o.a.y - o.b.y ), floatx8( o.a.y + o.b.y ) );
+		return float2x8( select( inside & alongx, sidex, p.x ), select( inside & ~alongx, sidey, p.y ) );
+	}
+	// spheres and capsules: distance to the segment a-b (a sphere has a == b)
+	const float2 ab = o.b - o.a;
+	const float abInvLen2 = o.type == Obstacle::CAPSULE ? 1 / dot( ab, ab ) : 0;
+	const float2x8 ap = p - float2x8( o.a );
+	const floatx8 t = min( max( dot( ap, float2x8( ab ) ) * abInvLen2, floatx8( 0.0f ) ), floatx8( 1.0f ) );
+	const float2x8 d = ap - float2x8( ab ) * t;
+	const floatx8 dist2 = max( dot( d, d ), floatx8( 1e-12f ) );
+	const maskx8 inside = dist2 < floatx8( o.radius * o.radius );
+	return select( inside, p + d * (fast_rsqrt( dist2 ) * o.radius - 1.0f), p );
+}
+static void CollideTile( const int tile, const Obstacle& o )
+{
+	const int x0 = (tile % TILES) * TILESIZE, y0 = (tile / TILES) * TILESIZE;
+	for (int y = y0; y < y0 + TILESIZE; y++) for (int x = x0; x < x0 + TILESIZE; x += 8)
+	{
+		const int i = idx( x, y );
+		const float2x8 p = ProjectOut( o, float2x8( floatx8::Load( posx + i ), floatx8::Load( posy + i ) ) );
+		p.x.Store( posx + i ), p.y.Store( posy + i );
+	}
+}
+
+// adaptive substeps
+// Press A to let the motion of the cloth pick the number of Verlet steps per
+// frame, instead of the fixed three. The integration kernel tracks the largest
+// distance an attached point moves in a step, as a running max over eight points
+// at a time; the next frame then takes enough steps to keep that distance below
+// MAXSTEPMOVE, and no more than fit in STEPBUDGET milliseconds at the measured
+// cost of a step. A frame always spans the time of three fixed steps, and each
+// step keeps its four constraint iterations, so fewer steps also make a softer
+// cloth: below MINSUBSTEPS, gusts tear it.
+#define MINSUBSTEPS 2
+#define MAXSUBSTEPS 8
+#define MAXSTEPMOVE 0.5f
+#define STEPBUDGET 40.0f
+bool adaptive = false;
+int substeps = 3;
+float lastDt = 1;				// length of the previous step, for the velocity term
+float maxSpeed = 0;				// largest distance moved per unit of time in the last frame
+float stepCost = 5;				// running average of the time a step takes, in ms
+static int AdaptiveSubsteps()
+{
+	// min keeps its first argument when the second is NaN, so an exploded cloth asks
+	// for all steps; the budget limits extra steps, but never drops below the fixed three
+	const int wanted = (int)ceilf( min( (float)MAXSUBSTEPS, 3 * maxSpeed / MAXSTEPMOVE ) );
+	const int affordable = max( 3, (int)(STEPBUDGET / stepCost) );
+	return max( MINSUBSTEPS, min( wanted, affordable ) );
+}
+
+// points that own no link and do not hang from the point above have come loose
+// (the bottom right corner never had a link); eight points from i, in row y
+template <int W = 0> static maskx8 Attached( const int i, const int y )
+{
+	ALIGN( 32 ) static const uint bits[2][8] = {
+		{ LINK_RIGHT | LINK_DOWN, LINK_RIGHT | LINK_DOWN, LINK_RIGHT | LINK_DOWN, LINK_RIGHT | LINK_DOWN,
+		  LINK_RIGHT | LINK_DOWN, LINK_RIGHT | LINK_DOWN, LINK_RIGHT | LINK_DOWN, LINK_RIGHT | LINK_DOWN },
+		{ LINK_DOWN, LINK_DOWN, LINK_DOWN, LINK_DOWN, LINK_DOWN, LINK_DOWN, LINK_DOWN, LINK_DOWN }
+	};
+	return testbits( uintx8::Load( links + i ), uintx8::Load( bits[0] ) ) |
+		testbits( uintx8::Load( links + (y ? i - Width<W>() : i) ), uintx8::Load( bits[1] ) );
+}
+
+// mouse grab
+// Click and drag to pull the grid cloth. Picking uses a grid of PICKCELL pixel
+// buckets over the screen, filled after every frame with a counting sort, so a
+// click only visits the points in the 3x3 buckets around the cursor instead of
+// all of them. The grabbed point is pinned to the cursor in the constraint loop,
+// together with the top line; points further than PICKRADIUS away are ignored.
+#define PICKCELL 16
+#define PICKW (SCRWIDTH / PICKCELL)
+#define PICKH (SCRHEIGHT / PICKCELL)
+#define PICKRADIUS 12.0f
+uint pickStart[PICKW * PICKH + 1];
+GridField<uint, GRIDMODES> pickPoint;
+int grabbed = -1;
+float2 grabPos;
+inline int PickBucket( const float x, const float y )
+{
+	// off-screen and exploded points go nowhere
+	if (!(x >= 0 && x < SCRWIDTH && y >= 0 && y < SCRHEIGHT)) return -1;
+	return (int)(y * (1.0f / PICKCELL)) * PICKW + (int)(x * (1.0f / PICKCELL));
+}
+static void BuildPickGrid()
+{
+	// count, turn counts into bucket ends, then fill each bucket back to front;
+	// the top line is fixed, so it is left out
+	const int N = gridSize * gridSize;
+	memset( pickStart, 0, sizeof( pickStart ) );
+	for (int i = gridSize; i < N; i++) {
+		const int b = PickBucket( posx[i], posy[i] );
+		if (b >= 0) pickStart[b]++;
+	}
+	for (int b = 1; b <= PICKW * PICKH; b++) pickStart[b] += pickStart[b - 1];
+	for (int i = N - 1; i >= gridSize; i--) {
+		const int b = PickBucket( posx[i], posy[i] );
+		if (b >= 0) pickPoint[--pickStart[b]] = i;
+	}
+}
+static int Pick( const float2 p )
+{
+	const int b = PickBucket( p.x, p.y );
+	if (b < 0) return -1;
+	const int bx = b % PICKW, by = b / PICKW;
+	int best = -1;
+	float bestDist2 = PICKRADIUS * PICKRADIUS;
+	for (int y = max( by - 1, 0 ); y <= min( by + 1, PICKH - 1 ); y++) for (int x = max( bx - 1, 0 ); x <= min( bx + 1, PICKW - 1 ); x++)
+		for (uint k = pickStart[x + y * PICKW]; k < pickStart[x + y * PICKW + 1]; k++) {
+			const uint i = pickPoint[k];
+			const float dist2 = sqrLength( make_float2( posx[i], posy[i] ) - p );
+			if (dist2 < bestDist2) best = i, bestDist2 = dist2;
 		}
+	return best;
+}
+// the top line is fixed, and so is the grabbed point
+static void PinPoints()
+{
+	for (int x = 0; x < gridSize; x++) posx[x] = fixpos[x].x, posy[x] = fixpos[x].y;
+	if (grabbed >= 0) posx[grabbed] = grabPos.x, posy[grabbed] = grabPos.y;
+}
+
+// mesh cloth
+// A coarser cloth with a round hole cut out of it, built as a general ClothMesh
+// to exercise the edge-list solver.
+#define MESHSIZE 128
+enum { STRUCTURAL = 0, SHEAR, BENDING }; // ClothMesh constraint families
+ClothMesh mesh;
+static void BuildMeshCloth()
+{
+	vector<float2> vertices;
+	vector<ClothMesh::Edge> edges;
+	vector<int> vertexOf( MESHSIZE * MESHSIZE, -1 );
+	const float2 hole = make_float2( MESHSIZE * 0.5f, MESHSIZE * 0.55f );
+	for (int y = 0; y < MESHSIZE; y++) for (int x = 0; x < MESHSIZE; x++) {
+		if (length( make_float2( (float)x, (float)y ) - hole ) < MESHSIZE * 0.15f) continue;
+		vertexOf[x + y * MESHSIZE] = (int)vertices.size();
+		vertices.push_back( make_float2( 10 + x * ((SCRWIDTH - 100) / MESHSIZE) + y * 1.8f, 10 + y * ((SCRHEIGHT - 180) / MESHSIZE) ) );
+	}
+	for (int y = 0; y < MESHSIZE; y++) for (int x = 0; x < MESHSIZE; x++) {
+		const int v = vertexOf[x + y * MESHSIZE], r = x < MESHSIZE - 1 ? vertexOf[x + 1 + y * MESHSIZE] : -1;
+		const int d = y < MESHSIZE - 1 ? vertexOf[x + (y + 1) * MESHSIZE] : -1;
+		if (v < 0) continue;
+		if (r >= 0) edges.push_back( { (uint)v, (uint)r, length( vertices[v] - vertices[r] ) * SLACK, STRUCTURAL } );
+		if (d >= 0) edges.push_back( { (uint)v, (uint)d, length( vertices[v] - vertices[d] ) * SLACK, STRUCTURAL } );
+	}
+	mesh.Build( vertices.data(), (uint)vertices.size(), edges.data(), (uint)edges.size() );
+	for (int x = 0; x < MESHSIZE; x++) mesh.Pin( vertexOf[x] );
+}
+void Game::DrawMesh() {
+	screen->Clear( 0 );
+	for (uint s = 0; s < mesh.slotCount; s++) if (mesh.ei[s] != mesh.vertexCount) {
+		const uint i = mesh.ei[s], j = mesh.ej[s];
+		screen->Line( mesh.x[i], mesh.y[i], mesh.x[j], mesh.y[j], 0xffffff );
+	}
+}
+
+// 3D cloth
+// A gridSize x gridSize sheet that starts out level and swings down from its
+// back edge. Besides the structural links to its four neighbours, each point is
+// linked to its diagonal neighbours (shear) and to the points two steps away
+// (bending): twelve links per point. Each family is coloured into batches of
+// its own. Bending links also push when compressed, so the sheet resists
+// folding. The sheet is projected through a mat4 camera into the grid arrays,
+// so that DrawGrid renders it unchanged.
+#define SPACING3D 3.0f
+ClothMesh cloth3D;
+mat4 camera;
+float breeze = 0;
+static void Build3DCloth()
+{
+	vector<float3> vertices( gridSize * gridSize );
+	vector<ClothMesh::Edge> edges;
+	const float spacing = SPACING3D * DEFAULTGRIDSIZE / gridSize; // the sheet keeps its size
+	for (int y = 0; y < gridSize; y++) for (int x = 0; x < gridSize; x++)
+		vertices[idx( x, y )] = make_float3( (x - gridSize / 2) * spacing, 300, (y - gridSize / 2) * spacing );
+	auto link = [&]( const int x0, const int y0, const int x1, const int y1, const uint family ) {
+		if (x1 < 0 || x1 >= gridSize || y1 >= gridSize) return;
+		const uint i = idx( x0, y0 ), j = idx( x1, y1 );
+		edges.push_back( { i, j, length( vertices[i] - vertices[j] ), family } );
+	};
+	for (int y = 0; y < gridSize; y++) for (int x = 0; x < gridSize; x++) {
+		link( x, y, x + 1, y, STRUCTURAL ), link( x, y, x, y + 1, STRUCTURAL );
+		link( x, y, x + 1, y + 1, SHEAR ), link( x, y, x - 1, y + 1, SHEAR );
+		link( x, y, x + 2, y, BENDING ), link( x, y, x, y + 2, BENDING );
+	}
+	cloth3D.Build( vertices.data(), (uint)vertices.size(), edges.data(), (uint)edges.size() );
+	cloth3D.SetFamily( STRUCTURAL, 1.0f, false );
+	cloth3D.SetFamily( SHEAR, 0.5f, false );
+	cloth3D.SetFamily( BENDING, 0.2f, true );
+	for (int x = 0; x < gridSize; x++) cloth3D.Pin( idx( x, 0 ) );
+	// world to screen: y is up in the world and down on the screen; w is the depth
+	const mat4 view = mat4::LookAt( make_float3( 600, 250, 1000 ), make_float3( 0, -150, -200 ), make_float3( 0, 1, 0 ) );
+	mat4 projection = mat4::ZeroMatrix();
+	projection( 0, 0 ) = 900, projection( 0, 2 ) = SCRWIDTH / 2;
+	projection( 1, 1 ) = -900, projection( 1, 2 ) = SCRHEIGHT / 2;
+	projection( 2, 2 ) = projection( 3, 2 ) = 1;
+	camera = projection * view;
+	breeze = 0;
+	// DrawGrid skips torn links
+	for (int i = 0; i < gridSize * gridSize; i++) links[i] = LINK_RIGHT | LINK_DOWN;
+}
+
+// initialization
+// points are a whole number of pixels apart while the grid fits, and closer for
+// larger grids
+static float Spacing( const int extent )
+{
+	return extent >= gridSize ? (float)(extent / gridSize) : (float)extent / gridSize;
+}
+static void InitGrid() {
+	// create the cloth; the slant and the jitter shrink with the spacing
+	const float sx = Spacing( SCRWIDTH - 100 ), sy = Spacing( SCRHEIGHT - 180 ), scale = (float)DEFAULTGRIDSIZE / gridSize;
+	for (int y = 0; y < gridSize; y++) for (int x = 0; x < gridSize; x++) {
+		posx[idx( x, y )] = 10 + (float)x * sx + y * (0.9f * scale) + Rand( 2 ) * scale;
+		posy[idx( x, y )] = 10 + (float)y * sy + Rand( 2 ) * scale;
+		prevx[idx( x, y )] = posx[idx( x, y )], prevy[idx( x, y )] = posy[idx( x, y )]; // all points start stationary
+		if (y == 0) fixpos[x] = position( x, y );
 	}
-	for (int y = 1; y < GRIDSIZE - 1; y++) for (int x = 1; x < GRIDSIZE - 1; x++) {
-		// calculate and store distance to four neighbours, allow 15% slack
-		for (int c = 0; c < 4; c++) {
-			grid( x, y ).restlength[c] = length( grid( x, y ).pos - grid( x + xoffset[c], y + yoffset[c] ).pos ) * 1.15f;
+	for (int y = 0; y < gridSize; y++) for (int x = 0; x < gridSize; x++) {
+		// link to the right and down, allow 15% slack; the top line is linked
+		// sideways for drawing, its points are fixed anyway
+		const int i = idx( x, y );
+		links[i] = 0;
+		if (x < gridSize - 1 && y < gridSize - 1) {
+			restlength[0][i] = length( position( x, y ) - position( x + 1, y ) ) * SLACK;
+			links[i] |= LINK_RIGHT;
+		}
+		if (x > 0 && x < gridSize - 1 && y < gridSize - 1) {
+			restlength[1][i] = length( position( x, y ) - position( x, y + 1 ) ) * SLACK;
+			links[i] |= LINK_DOWN;
+		}
+		// shear and bending links stay away from the edges as well
+		for (int t = 2; t < LINKTYPES; t++) {
+			const int x2 = x + linkdx[t], y2 = y + linkdy[t];
+			if (x < 1 || x > gridSize - 2 || x2 < 1 || x2 > gridSize - 2 || y > gridSize - 2 || y2 > gridSize - 1) continue;
+			restlength[t][i] = length( position( x, y ) - position( x2, y2 ) ) * SLACK;
+			links[i] |= 1 << t;
 		}
 	}
+	tornLinks = 0;
 }
 
 // cloth rendering
@@ -80,18 +417,18 @@ void Game::Init() {
 void Game::DrawGrid() {
 	// draw the grid
 	screen->Clear( 0 );
-	for (int y = 0; y < (GRIDSIZE - 1); y++) for (int x = 1; x < (GRIDSIZE - 2); x++) {
-		const float2 p1 = grid( x, y ).pos;
-		const float2 p2 = grid( x + 1, y ).pos;
-		const float2 p3 = grid( x, y + 1 ).pos;
-		screen->Line( p1.x, p1.y, p2.x, p2.y, 0xffffff );
-		screen->Line( p1.x, p1.y, p3.x, p3.y, 0xffffff );
+	for (int y = 0; y < (gridSize - 1); y++) for (int x = 1; x < (gridSize - 2); x++) {
+		const float2 p1 = position( x, y );
+		const float2 p2 = position( x + 1, y );
+		const float2 p3 = position( x, y + 1 );
+		if (links[idx( x, y )] & LINK_RIGHT) screen->Line( p1.x, p1.y, p2.x, p2.y, 0xffffff );
+		if (links[idx( x, y )] & LINK_DOWN) screen->Line( p1.x, p1.y, p3.x, p3.y, 0xffffff );
 	}
 
-	for (int y = 0; y < (GRIDSIZE - 1); y++) {
-		const float2 p1 = grid( GRIDSIZE - 2, y ).pos;
-		const float2 p2 = grid( GRIDSIZE - 2, y + 1 ).pos;
-		screen->Line( p1.x, p1.y, p2.x, p2.y, 0xffffff );
+	for (int y = 0; y < (gridSize - 1); y++) {
+		const float2 p1 = position( gridSize - 2, y );
+		const float2 p2 = position( gridSize - 2, y + 1 );
+		if (links[idx( gridSize - 2, y )] & LINK_DOWN) screen->Line( p1.x, p1.y, p2.x, p2.y, 0xffffff );
 	}
 }
 
@@ -101,47 +438,1024 @@ void Game::DrawGrid() {
 // drawn together to restore the rest length. When running on the GPU or
 // when using SIMD, this will only work if the two vertices are not
 // operated upon simultaneously (in a vector register, or in a warp).
-float magic = 0.11f;
-void Game::Simulation() {
-	// simulation is exected three times per frame; do not change this.
-	for( int steps = 0; steps < 3; steps++ ) {
-		// verlet integration; apply gravity
-		for (int y = 0; y < GRIDSIZE; y++) for (int x = 0; x < GRIDSIZE; x++) {
-			float2 curpos = grid( x, y ).pos, prevpos = grid( x, y ).prev_pos;
-			grid( x, y ).pos += (curpos - prevpos) + float2( 0, 0.003f ); // gravity
-			grid( x, y ).prev_pos = curpos;
-			if (Rand( 10 ) < 0.03f) grid( x, y ).pos += float2( Rand( 0.02f + magic ), Rand( 0.12f ) );
-		}
-
-		magic += 0.0002f; // slowly increases the chance of anomalies
-		// apply constraints; 4 simulation steps: do not change this number.
-		for (int i = 0; i < 4; i++) {
-			for (int y = 1; y < GRIDSIZE - 1; y++) for (int x = 1; x < GRIDSIZE - 1; x++) {
-				float2 pointpos = grid( x, y ).pos;
-				// use springs to four neighbouring points
-				for (int linknr = 0; linknr < 4; linknr++) {
-					Point& neighbour = grid( x + xoffset[linknr], y + yoffset[linknr] );
-					float distance = length( neighbour.pos - pointpos );
-					if (!isfinite( distance )) {
-						// warning: this happens; sometimes vertex positions 'explode'.
-						continue;
-					}
 
-					if (distance > grid( x, y ).restlength[linknr]) {
-						// pull points together
-						float extra = distance / (grid( x, y ).restlength[linknr]) - 1;
-						float2 dir = neighbour.pos - pointpos;
-						pointpos += extra * dir * 0.5f;
-						neighbour.pos -= extra * dir * 0.5f;
+// constraints
+// Links pull their end points together when stretched beyond their rest length.
+// A stencil lists the link offsets that are solved, as template parameters, so
+// each Link<W, DX, DY> compiles to its own kernel with constant strides, and a
+// stencil solves its links one after another without dispatch in between. The
+// links of one offset are solved in two passes of independent links: for a
+// horizontal offset, runs of DX links alternate within the row, otherwise runs
+// of DY rows alternate. Within a pass no point is moved by two lanes or two
+// threads, so eight links are solved at a time and rows run in parallel. Dead
+// links are masked out rather than skipped. A link stretched beyond TEARSTRAIN
+// times its rest length breaks. Links to exploded points need no test of their
+// own: fast_sqrt returns zero for a NaN squared distance and NaN for an infinite
+// one, so their stretch fails the stretch > 1 and tear tests, and they are
+// neither pulled nor torn. Press C to switch between the four neighbours,
+// eight with the shear links, or twelve with the bending links as well.
+#define TEARSTRAIN 3.0f
+
+// correction to apply to p (and, negated, to q) for eight links from p to q
+static float2x8 Pull( const int i, const uint bit, maskx8 active, const float2x8& p, const float2x8& q, const floatx8& rest )
+{
+	const float2x8 d = q - p;
+	const floatx8 stretch = fast_length( d ) * fast_rcp( rest ); // zero (NaN distance) or NaN (infinite) for exploded points
+	const maskx8 torn = active & (stretch > floatx8( TEARSTRAIN ));
+	if (any( torn )) {
+		// rare: clear the bit of each torn link
+		for (int bits = torn.Bits(), lane = 0; bits; bits >>= 1, lane++) if (bits & 1) links[i + lane] &= ~bit, tornLinks++;
+		active = active & ~torn;
+	}
+	const floatx8 zero( 0.0f );
+	return select( active & (stretch > floatx8( 1.0f )), d * ((stretch - 1.0f) * 0.5f), float2x8( zero, zero ) );
+}
+template <int W, int DX, int DY> struct Link
+{
+	static_assert( LinkType( DX, DY ) >= 0, "the grid has no links with this offset" );
+	static_assert( DY > 0 || (DX > 0 && 8 % (2 * DX) == 0), "runs of horizontal links must tile a vector" );
+	static constexpr int type = LinkType( DX, DY );
+	static constexpr uint bit = 1u << type;
+	static void SolveRow( const int y );
+	static void Solve();
+};
+template <int W, int DX, int DY> void Link<W, DX, DY>::SolveRow( const int y )
+{
+	// lane masks; bit is set in the lanes of each pass
+	struct ALIGN( 32 ) Masks { uint pass[2][8]; };
+	static const Masks masks = [] {
+		Masks m = {};
+		for (int lane = 0; lane < 8; lane++) m.pass[DY > 0 ? 0 : (lane / DX) & 1][lane] = bit;
+		return m;
+	}();
+	const int width = Width<W>();
+	if constexpr (DY == 0) {
+		// a point is the left end of one link and the right end of another, so the
+		// corrections for the row are collected first; c[8 - DX .. 7] stand in for
+		// the points left of x = 0
+		ALIGN( 32 ) float cx[(W > 0 ? W : MAXGRIDSIZE) + 8], cy[(W > 0 ? W : MAXGRIDSIZE) + 8];
+		for (int k = 8 - DX; k < 8; k++) cx[k] = cy[k] = 0;
+		for (int pass = 0; pass < 2; pass++) {
+			const uintx8 mask = uintx8::Load( masks.pass[pass] );
+			for (int x = 0; x < width; x += 8) {
+				const int i = Idx<W>( x, y );
+				const float2x8 p( floatx8::Load( posx + i ), floatx8::Load( posy + i ) );
+				const float2x8 q( floatx8::LoadU( posx + i + DX ), floatx8::LoadU( posy + i + DX ) );
+				const maskx8 active = testbits( uintx8::Load( links + i ), mask );
+				const float2x8 c = Pull( i, bit, active, p, q, floatx8::Load( restlength[type] + i ) );
+				c.x.Store( cx + x + 8 ), c.y.Store( cy + x + 8 );
+			}
+			for (int x = 0; x < width; x += 8) {
+				const int i = Idx<W>( x, y );
+				(floatx8::Load( posx + i ) + floatx8::Load( cx + x + 8 ) - floatx8::LoadU( cx + x + 8 - DX )).Store( posx + i );
+				(floatx8::Load( posy + i ) + floatx8::Load( cy + x + 8 ) - floatx8::LoadU( cy + x + 8 - DX )).Store( posy + i );
+			}
+		}
+	} else {
+		const uintx8 mask = uintx8::Load( masks.pass[0] );
+		const int offset = DX + DY * width;
+		for (int x = 0; x < width; x += 8) {
+			const int i = Idx<W>( x, y ), j = i + offset;
+			const float2x8 p( floatx8::Load( posx + i ), floatx8::Load( posy + i ) );
+			const float2x8 q( floatx8::LoadU( posx + j ), floatx8::LoadU( posy + j ) );
+			const maskx8 active = testbits( uintx8::Load( links + i ), mask );
+			const float2x8 c = Pull( i, bit, active, p, q, floatx8::Load( restlength[type] + i ) );
+			(p.x + c.x).Store( posx + i ), (p.y + c.y).Store( posy + i );
+			if ((DX > 0 && x + 8 + DX > width) || (DX < 0 && x + DX < 0)) {
+				// the edge lanes of q fall outside row y + DY, in a row that another
+				// thread may be solving; write back only the lanes inside the row
+				ALIGN( 32 ) float qx[8], qy[8];
+				(q.x - c.x).Store( qx ), (q.y - c.y).Store( qy );
+				for (int lane = 0; lane < 8; lane++) if (x + lane + DX >= 0 && x + lane + DX < width) posx[j + lane] = qx[lane], posy[j + lane] = qy[lane];
+			}
+			else (q.x - c.x).StoreU( posx + j ), (q.y - c.y).StoreU( posy + j );
+		}
+	}
+}
+template <int W, int DX, int DY> void Link<W, DX, DY>::Solve()
+{
+	JobManager* jm = JobManager::GetJobManager();
+	const int width = Width<W>();
+	if constexpr (DY == 0) jm->ParallelFor( 0, width - 1, 8, []( int first, int last, JobContext& ) {
+		for (int y = first; y < last; y++) SolveRow( y );
+	} );
+	// rows y and y + DY share points, so runs of DY rows alternate between the passes
+	else for (int pass = 0; pass < 2; pass++) {
+		const int runs = (width - DY - pass * DY + 2 * DY - 1) / (2 * DY);
+		jm->ParallelFor( 0, runs, max( 1, 4 / DY ), [pass, width]( int first, int last, JobContext& ) {
+			for (int run = first; run < last; run++) for (int k = 0; k < DY; k++) {
+				const int y = (run * 2 + pass) * DY + k;
+				if (y < width - DY) SolveRow( y );
+			}
+		} );
+	}
+}
+template <class... Links> struct Stencil
+{
+	static void Solve() { (Links::Solve(), ...); }
+};
+template <int W> using Stencil4 = Stencil<Link<W, 1, 0>, Link<W, 0, 1>>;
+template <int W> using Stencil8 = Stencil<Link<W, 1, 0>, Link<W, 0, 1>, Link<W, 1, 1>, Link<W, -1, 1>>;
+template <int W> using Stencil12 = Stencil<Link<W, 1, 0>, Link<W, 0, 1>, Link<W, 1, 1>, Link<W, -1, 1>, Link<W, 2, 0>, Link<W, 0, 2>>;
+int stencil = 0;	// four, eight or twelve neighbours
+
+// strain analysis
+// Once per frame, the strain (length / rest length - 1) of every intact link is
+// measured eight links at a time, with rows in parallel. Each row reduces to a
+// maximum, a sum, a count and a histogram of STRAINBINS bins that span zero up
+// to the tearing strain; slack links land in the first bin and links about to
+// tear in the last. Rows are then combined in a fixed order, as in SumRows, so
+// the statistics do not depend on the thread count. Press H to draw the links
+// coloured by strain instead of plain white.
+#define STRAINBINS 16
+#define MAXSTRAIN (TEARSTRAIN - 1)
+GridField<float, GRIDMODES | 1 << MODE_LOD> strain[2];
+struct StrainStats { float max, mean; uint count, histogram[STRAINBINS]; } strainStats;
+bool heatmap = false;
+static void AnalyzeStrain()
+{
+	static float rowMax[MAXGRIDSIZE], rowSum[MAXGRIDSIZE];
+	static uint rowCount[MAXGRIDSIZE], rowHistogram[MAXGRIDSIZE][STRAINBINS];
+	JobManager::GetJobManager()->ParallelFor( 0, gridSize, 8, []( int first, int last, JobContext& ) {
+		ALIGN( 32 ) static const uint bits[2][8] = {
+			{ LINK_RIGHT, LINK_RIGHT, LINK_RIGHT, LINK_RIGHT, LINK_RIGHT, LINK_RIGHT, LINK_RIGHT, LINK_RIGHT },
+			{ LINK_DOWN, LINK_DOWN, LINK_DOWN, LINK_DOWN, LINK_DOWN, LINK_DOWN, LINK_DOWN, LINK_DOWN }
+		};
+		const floatx8 zero( 0.0f ), one( 1.0f ), huge( 1e30f ), scale( STRAINBINS / MAXSTRAIN ), top( STRAINBINS - 1 );
+		for (int y = first; y < last; y++) {
+			floatx8 max8( 0.0f ), sum8( 0.0f ), count8( 0.0f );
+			uint* histogram = rowHistogram[y];
+			memset( histogram, 0, STRAINBINS * sizeof( uint ) );
+			for (int x = 0; x < gridSize; x += 8) {
+				const int i = idx( x, y );
+				const float2x8 p( floatx8::Load( posx + i ), floatx8::Load( posy + i ) );
+				for (int link = 0; link < 2; link++) {
+					// the bottom row has no down links; its points read themselves
+					const int j = link == 0 ? i + 1 : y < gridSize - 1 ? i + gridSize : i;
+					const float2x8 d = float2x8( floatx8::LoadU( posx + j ), floatx8::LoadU( posy + j ) ) - p;
+					const floatx8 s = sqrt( dot( d, d ) ) / floatx8::Load( restlength[link] + i ) - one;
+					// dead links and exploded points are left out of the statistics
+					const maskx8 valid = testbits( uintx8::Load( links + i ), uintx8::Load( bits[link] ) ) & (s < huge);
+					const floatx8 sv = select( valid, s, zero );
+					sv.Store( strain[link] + i );
+					max8 = max( sv, max8 ), sum8 = sum8 + sv, count8 = count8 + select( valid, one, zero );
+					ALIGN( 32 ) float bin[8];
+					min( max( sv * scale, zero ), top ).Store( bin );
+					for (int b = valid.Bits(), lane = 0; b; b >>= 1, lane++) if (b & 1) histogram[(int)bin[lane]]++;
+				}
+			}
+			rowMax[y] = hmax( max8 ), rowSum[y] = hsum( sum8 ), rowCount[y] = (uint)hsum( count8 );
+		}
+	} );
+	StrainStats stats = {};
+	double sum = 0;
+	for (int y = 0; y < gridSize; y++) {
+		stats.max = max( stats.max, rowMax[y] ), sum += rowSum[y], stats.count += rowCount[y];
+		for (int b = 0; b < STRAINBINS; b++) stats.histogram[b] += rowHistogram[y][b];
+	}
+	stats.mean = stats.count ? (float)(sum / stats.count) : 0;
+	strainStats = stats;
+}
+
+// blue for relaxed links, through green and yellow to red at the tearing strain;
+// most of the range goes to low strains, where nearly all links are
+static uint StrainColor( const float s )
+{
+	const float t = sqrtf( clamp( s / MAXSTRAIN, 0.0f, 1.0f ) ) * 3;
+	const float r = clamp( t - 1, 0.0f, 1.0f ), g = t < 2 ? clamp( t, 0.0f, 1.0f ) : 3 - t, b = clamp( 1 - t, 0.0f, 1.0f );
+	return ((uint)(r * 255) << 16) + ((uint)(g * 255) << 8) + (uint)(b * 255);
+}
+
+void Game::DrawStrain() {
+	// the links DrawGrid draws, in colour, with the strain histogram in the corner
+	screen->Clear( 0 );
+	for (int y = 0; y < (gridSize - 1); y++) for (int x = 1; x < (gridSize - 2); x++) {
+		const int i = idx( x, y );
+		const float2 p1 = position( x, y );
+		if (links[i] & LINK_RIGHT) {
+			const float2 p2 = position( x + 1, y );
+			screen->Line( p1.x, p1.y, p2.x, p2.y, StrainColor( strain[0][i] ) );
+		}
+		if (links[i] & LINK_DOWN) {
+			const float2 p3 = position( x, y + 1 );
+			screen->Line( p1.x, p1.y, p3.x, p3.y, StrainColor( strain[1][i] ) );
+		}
+	}
+	for (int y = 0; y < (gridSize - 1); y++) {
+		const int i = idx( gridSize - 2, y );
+		const float2 p1 = position( gridSize - 2, y ), p2 = position( gridSize - 2, y + 1 );
+		if (links[i] & LINK_DOWN) screen->Line( p1.x, p1.y, p2.x, p2.y, StrainColor( strain[1][i] ) );
+	}
+	const uint total = max( 1u, strainStats.count );
+	for (int b = 0; b < STRAINBINS; b++) {
+		// bar heights are logarithmic, so the few links close to tearing still show
+		const int h = strainStats.histogram[b] ? (int)(log2f( 1.0f + strainStats.histogram[b] ) * 64 / log2f( 1.0f + total )) + 1 : 0;
+		const int x1 = SCRWIDTH - 8 - (STRAINBINS - b) * 10;
+		screen->Bar( x1, 8 + 64 - h, x1 + 8, 8 + 64, StrainColor( (b + 0.5f) * MAXSTRAIN / STRAINBINS ) );
+	}
+}
+
+// self-collision
+// Points that are not linked but come closer than THICKNESS push each other
+// apart. Once per step, points are hashed into a uniform grid of THICKNESS-sized
+// cells; a counting sort yields a contiguous range per hash bucket, without
+// per-cell allocations. The hash keeps horizontally adjacent cells in adjacent
+// buckets, so the three cells of each row of a 3x3 neighbourhood form a single
+// range, and the sort copies positions into bucket order so that this range is
+// read sequentially. Every point sums the push from the points around it;
+// points only write their own push, so this runs in parallel without atomics
+// or colouring. Pushes are averaged (Jacobi style) and applied in a separate pass.
+#define THICKNESS 1.5f
+#define HASHPITCH 1024
+#define HASHSIZE (1 << 18)
+uint* bucketStart = (uint*)MALLOC64( (HASHSIZE + 1) * sizeof( uint ) );
+GridField<int2, GRIDMODES> pointCell, sortedCell;
+GridField<float2, GRIDMODES> sortedPos;
+GridField<uint, GRIDMODES> sortedIdx;
+GridField<float, GRIDMODES> pushx, pushy;
+inline uint CellHash( const int x, const int y ) { return ((uint)y * HASHPITCH + (uint)x) & (HASHSIZE - 1); }
+
+static void SelfCollision()
+{
+	// counting sort: count, turn counts into bucket ends, then fill each bucket back to front
+	const int N = gridSize * gridSize;
+	memset( bucketStart, 0, HASHSIZE * sizeof( uint ) );
+	bucketStart[HASHSIZE] = N;
+	for (int i = 0; i < N; i++) {
+		// clamp first, so that exploded points do not overflow the conversion
+		const float cx = fminf( fmaxf( posx[i] * (1 / THICKNESS), -1e6f ), 1e6f );
+		const float cy = fminf( fmaxf( posy[i] * (1 / THICKNESS), -1e6f ), 1e6f );
+		pointCell[i] = make_int2( (int)floorf( cx ), (int)floorf( cy ) );
+		bucketStart[CellHash( pointCell[i].x, pointCell[i].y )]++;
+	}
+	for (int b = 1; b < HASHSIZE; b++) bucketStart[b] += bucketStart[b - 1];
+	for (int i = N - 1; i >= 0; i--) {
+		const uint slot = --bucketStart[CellHash( pointCell[i].x, pointCell[i].y )];
+		sortedCell[slot] = pointCell[i], sortedPos[slot] = make_float2( posx[i], posy[i] ), sortedIdx[slot] = i;
+	}
+	// gather pushes
+	JobManager::GetJobManager()->ParallelFor( 0, gridSize, 8, []( int first, int last, JobContext& ) {
+		for (int i = first * gridSize; i < last * gridSize; i++) {
+			const float2 p = make_float2( posx[i], posy[i] );
+			float2 push = make_float2( 0 );
+			float contacts = 0;
+			if (fabsf( p.x ) < 1e5f && fabsf( p.y ) < 1e5f) { // skip exploded points; they all share one cell
+				const int2 c = pointCell[i];
+				for (int y = c.y - 1; y <= c.y + 1; y++) {
+					// the three buckets form one range, unless they wrap around the end of the table
+					const uint h = CellHash( c.x - 1, y ), hEnd = h + 3;
+					const uint range[4] = { bucketStart[h], bucketStart[min( hEnd, (uint)HASHSIZE )], 0, hEnd > HASHSIZE ? bucketStart[hEnd - HASHSIZE] : 0 };
+					for (int r = 0; r < 4; r += 2) for (uint k = range[r]; k < range[r + 1]; k++) {
+						if (sortedCell[k].y != y || abs( sortedCell[k].x - c.x ) > 1) continue; // other cell, same bucket
+						const uint j = sortedIdx[k];
+						if (j == (uint)i || Linked( i, j )) continue;
+						const float2 e = p - sortedPos[k];
+						const float d2 = dot( e, e );
+						if (d2 >= THICKNESS * THICKNESS || d2 < 1e-12f) continue;
+						const float d = sqrtf( d2 );
+						push += e * (0.5f * (THICKNESS - d) / d), contacts++;
 					}
 				}
+			}
+			// average rather than sum: in a crumpled area, summed pushes overshoot
+			if (contacts > 1) push *= 1 / contacts;
+			pushx[i] = push.x, pushy[i] = push.y;
+		}
+	} );
+	// apply; the top line is fixed
+	for (int i = gridSize; i < N; i += 8) {
+		(floatx8::Load( posx + i ) + floatx8::Load( pushx + i )).Store( posx + i );
+		(floatx8::Load( posy + i ) + floatx8::Load( pushy + i )).Store( posy + i );
+	}
+}
 
-				grid( x, y ).pos = pointpos;
+// wind
+// A coarse noise field that drifts across the screen. It is rebuilt once per
+// step and sampled bilinearly by the integration kernel. On average it pushes
+// as hard as the random impulses it replaces, which gave 0.3% of the points a
+// kick of up to ( 0.02 + magic, 0.12 ) per step, but neighbouring points now
+// feel the same gust.
+#define WINDRES 32
+struct WindField
+{
+	void Update( const float2 strength, const float dt = 1 )
+	{
+		// scroll the noise, so that gusts travel with the wind. Cells are 8 noise
+		// units apart; wider spacing turns the finest octaves into cell-to-cell
+		// jitter, which shears the cloth apart.
+		time += 0.8f * dt;
+		noise2DField( wx, WINDRES, WINDRES, -time, 0.3f * time, 8, 8, false );
+		noise2DField( wy, WINDRES, WINDRES, 1000 - 0.7f * time, 1000 + 0.2f * time, 8, 8, false );
+		// noise2D stays within about +/-0.18; map it to 0.1 .. 1.9 times the average push
+		for (int i = 0; i < WINDRES * WINDRES; i++)
+			wx[i] = strength.x * (1 + 5 * wx[i]), wy[i] = strength.y * (1 + 5 * wy[i]);
+	}
+	float2x8 Sample( const floatx8& x, const floatx8& y ) const
+	{
+		// max before min, so NaN coordinates of exploded points land on cell 0
+		const floatx8 u = min( max( x * ((WINDRES - 1.0f) / SCRWIDTH), floatx8( 0.0f ) ), floatx8( WINDRES - 1.001f ) );
+		const floatx8 v = min( max( y * ((WINDRES - 1.0f) / SCRHEIGHT), floatx8( 0.0f ) ), floatx8( WINDRES - 1.001f ) );
+		const floatx8 u0 = floor( u ), v0 = floor( v ), fu = u - u0, fv = v - v0, cell = fmadd( v0, floatx8( WINDRES ), u0 );
+		return float2x8( Bilinear( wx, cell, fu, fv ), Bilinear( wy, cell, fu, fv ) );
+	}
+	static floatx8 Bilinear( const float* field, const floatx8& cell, const floatx8& fu, const floatx8& fv )
+	{
+		const floatx8 a = gather( field, cell ), b = gather( field, cell + 1.0f );
+		const floatx8 c = gather( field, cell + (float)WINDRES ), d = gather( field, cell + (WINDRES + 1.0f) );
+		const floatx8 top = fmadd( b - a, fu, a ), bottom = fmadd( d - c, fu, c );
+		return fmadd( bottom - top, fv, top );
+	}
+	ALIGN( 64 ) float wx[WINDRES * WINDRES], wy[WINDRES * WINDRES];
+	float time = 0;
+} wind;
+
+float magic = 0.11f;
+
+// implicit integration
+// Advances the grid with one backward Euler step of IMPLICITSTEP per frame,
+// instead of three Verlet steps. Links act as springs of stiffness IMPLICITK.
+// Each step solves
+//   (I + s K) dv = h (f - (h + beta) K v),  s = h^2 + h beta
+// for the change in velocity, where K is the stiffness matrix of the links and
+// beta damps motion along them. The grid stencil fixes the neighbours of each
+// point, so K is stored as the symmetric 2x2 block of the right and the down
+// link of each point: diagonal (DIA) storage with offsets 1 and gridSize, which
+// every kernel reads as contiguous rows, eight points at a time. Multiplying by
+// K sums the four link blocks around a point times x_i - x_j. Conjugate
+// gradients, preconditioned with the inverse 2x2 diagonal blocks, solve the
+// system; SpMV, dot products and updates are fused into one pass over the rows
+// where possible, and rows run in parallel. Velocities are kept in units per
+// Verlet step (prev = pos - v), so switching modes keeps the cloth moving.
+// Unlike the constraints, the springs have no slack and also push: a spring
+// that is slack at the start of a step is missing from the linear system, so
+// with pull-only springs every link that goes taut during a step overstretches,
+// and the cloth gains energy until it tears.
+#define IMPLICITSTEP 3.0f
+#define IMPLICITK 20.0f
+#define IMPLICITDAMPING 0.5f
+#define CGITERATIONS 100
+#define CGTOLERANCE 1e-3f		// relative to the initial residual
+const float implicitS = IMPLICITSTEP * (IMPLICITSTEP + IMPLICITDAMPING);
+typedef GridField<float, 1 << MODE_IMPLICIT> SolverField;
+SolverField block[2][3];			// xx, xy, yy of the right / down link
+SolverField linkfx[2], linkfy[2];	// force of the right / down link on its first point
+SolverField precond[3];				// xx, xy, yy of the inverse diagonal block
+SolverField velx, vely, dvx, dvy;
+SolverField rx, ry, zx, zy;
+SolverField px, py, qx, qy;
+
+// spring force and stiffness block of the links of eight points; stores the velocity
+static void AssembleLinks( const int y )
+{
+	ALIGN( 32 ) static const uint bits[2][8] = {
+		{ LINK_RIGHT, LINK_RIGHT, LINK_RIGHT, LINK_RIGHT, LINK_RIGHT, LINK_RIGHT, LINK_RIGHT, LINK_RIGHT },
+		{ LINK_DOWN, LINK_DOWN, LINK_DOWN, LINK_DOWN, LINK_DOWN, LINK_DOWN, LINK_DOWN, LINK_DOWN }
+	};
+	const floatx8 zero( 0.0f ), one( 1.0f ), k( IMPLICITK );
+	for (int x = 0; x < gridSize; x += 8) {
+		const int i = idx( x, y );
+		const float2x8 p( floatx8::Load( posx + i ), floatx8::Load( posy + i ) );
+		(p.x - floatx8::Load( prevx + i )).Store( velx + i ), (p.y - floatx8::Load( prevy + i )).Store( vely + i );
+		for (int link = 0; link < 2; link++) {
+			// the bottom row has no down links; reading itself keeps its loads in range
+			const int j = link == 0 ? i + 1 : y < gridSize - 1 ? i + gridSize : i;
+			const float2x8 d = float2x8( floatx8::LoadU( posx + j ), floatx8::LoadU( posy + j ) ) - p;
+			const floatx8 len = sqrt( dot( d, d ) ), rest = floatx8::Load( restlength[link] + i );
+			maskx8 active = testbits( uintx8::Load( links + i ), uintx8::Load( bits[link] ) ) & (len > zero);
+			const maskx8 torn = active & (len > rest * TEARSTRAIN);
+			if (any( torn )) {
+				const uint bit = link == 0 ? LINK_RIGHT : LINK_DOWN;
+				for (int mask = torn.Bits(), lane = 0; mask; mask >>= 1, lane++) if (mask & 1) links[i + lane] &= ~bit, tornLinks++;
+				active = active & ~torn;
 			}
-			// fixed line of points is fixed.
-			for (int x = 0; x < GRIDSIZE; x++) grid( x, 0 ).pos = grid( x, 0 ).fix;
+			// force k (len - rest) n = k t d; stiffness k (n n^T + t (I - n n^T)), where
+			// t is clamped for compressed springs to keep K positive semi-definite
+			const floatx8 invLen = select( active, one / len, zero ), t = select( active, one - rest * (1 / SLACK) * invLen, zero );
+			const floatx8 nx = d.x * invLen, ny = d.y * invLen, tk = max( t, zero ), kn = k * (one - tk);
+			(k * t * d.x).Store( linkfx[link] + i ), (k * t * d.y).Store( linkfy[link] + i );
+			fmadd( kn, nx * nx, k * tk ).Store( block[link][0] + i );
+			(kn * nx * ny).Store( block[link][1] + i );
+			fmadd( kn, ny * ny, k * tk ).Store( block[link][2] + i );
+		}
+	}
+}
+
+// K v for eight points of row y > 0
+static float2x8 StiffnessTimes( const int i, const int y, const float* vx, const float* vy )
+{
+	const float2x8 v( floatx8::Load( vx + i ), floatx8::Load( vy + i ) );
+	float2x8 sum( floatx8( 0.0f ), floatx8( 0.0f ) );
+	const auto add = [&]( const SolverField* b, const int k, const int j ) {
+		const float2x8 d = v - float2x8( floatx8::LoadU( vx + j ), floatx8::LoadU( vy + j ) );
+		const floatx8 bxx = floatx8::LoadU( b[0] + k ), bxy = floatx8::LoadU( b[1] + k ), byy = floatx8::LoadU( b[2] + k );
+		sum.x = fmadd( bxx, d.x, fmadd( bxy, d.y, sum.x ) );
+		sum.y = fmadd( bxy, d.x, fmadd( byy, d.y, sum.y ) );
+	};
+	add( block[0], i, i + 1 ), add( block[0], i - 1, i - 1 ), add( block[1], i - gridSize, i - gridSize );
+	if (y < gridSize - 1) add( block[1], i, i + gridSize );
+	return sum;
+}
+
+// z = M^-1 r for eight points; returns r.z
+static floatx8 Precondition( const int i )
+{
+	const floatx8 x = floatx8::Load( rx + i ), y = floatx8::Load( ry + i );
+	const floatx8 pxy = floatx8::Load( precond[1] + i );
+	const floatx8 z1 = fmadd( floatx8::Load( precond[0] + i ), x, pxy * y ), z2 = fmadd( pxy, x, floatx8::Load( precond[2] + i ) * y );
+	z1.Store( zx + i ), z2.Store( zy + i );
+	return fmadd( x, z1, y * z2 );
+}
+
+// runs f( y ) for the free rows in parallel and sums what it returns, in a fixed order
+template <class F> static float SumRows( const F& f )
+{
+	static float rowSum[MAXGRIDSIZE];
+	JobManager::GetJobManager()->ParallelFor( 1, gridSize, 8, [&f]( int first, int last, JobContext& ) {
+		for (int y = first; y < last; y++) rowSum[y] = f( y );
+	} );
+	double sum = 0;
+	for (int y = 1; y < gridSize; y++) sum += rowSum[y];
+	return (float)sum;
+}
+
+static void ImplicitStep()
+{
+	JobManager* jm = JobManager::GetJobManager();
+	wind.Update( make_float2( 0.0015f * (0.02f + magic), 0.0015f * 0.12f ) );
+	magic += 0.0002f * IMPLICITSTEP;
+	jm->ParallelFor( 0, gridSize, 8, []( int first, int last, JobContext& ) {
+		for (int y = first; y < last; y++) AssembleLinks( y );
+	} );
+	// right-hand side and preconditioner; CG starts from dv = 0, so r = b
+	float rz = SumRows( []( const int y ) {
+		const floatx8 one( 1.0f ), h( IMPLICITSTEP ), s( implicitS ), gravity( 0.003f );
+		floatx8 rzRow( 0.0f );
+		for (int x = 0; x < gridSize; x += 8) {
+			const int i = idx( x, y ), up = i - gridSize;
+			const floatx8 x8 = floatx8::Load( posx + i ), y8 = floatx8::Load( posy + i );
+			const float2x8 Kv = StiffnessTimes( i, y, velx, vely ), wind8 = wind.Sample( x8, y8 );
+			const floatx8 fx = wind8.x + floatx8::Load( linkfx[0] + i ) - floatx8::LoadU( linkfx[0] + i - 1 ) + floatx8::Load( linkfx[1] + i ) - floatx8::Load( linkfx[1] + up );
+			const floatx8 fy = wind8.y + gravity + floatx8::Load( linkfy[0] + i ) - floatx8::LoadU( linkfy[0] + i - 1 ) + floatx8::Load( linkfy[1] + i ) - floatx8::Load( linkfy[1] + up );
+			(h * (fx - (IMPLICITSTEP + IMPLICITDAMPING) * Kv.x)).Store( rx + i );
+			(h * (fy - (IMPLICITSTEP + IMPLICITDAMPING) * Kv.y)).Store( ry + i );
+			// the diagonal block of I + s K sums the four link blocks around the point
+			floatx8 d[3];
+			for (int c = 0; c < 3; c++) d[c] = floatx8::Load( block[0][c] + i ) + floatx8::LoadU( block[0][c] + i - 1 ) + floatx8::Load( block[1][c] + i ) + floatx8::Load( block[1][c] + up );
+			const floatx8 a = fmadd( s, d[0], one ), b = s * d[1], c = fmadd( s, d[2], one ), invDet = one / (a * c - b * b);
+			(c * invDet).Store( precond[0] + i ), (-b * invDet).Store( precond[1] + i ), (a * invDet).Store( precond[2] + i );
+			rzRow = rzRow + Precondition( i );
+			floatx8::Load( zx + i ).Store( px + i ), floatx8::Load( zy + i ).Store( py + i );
+			floatx8( 0.0f ).Store( dvx + i ), floatx8( 0.0f ).Store( dvy + i );
 		}
+		return hsum( rzRow );
+	} );
+	// conjugate gradients; NaNs from exploded points fail the test and end the loop
+	const float target = rz * CGTOLERANCE * CGTOLERANCE;
+	for (int iteration = 0; iteration < CGITERATIONS && rz > target; iteration++) {
+		// q = A p
+		const float pq = SumRows( []( const int y ) {
+			floatx8 pqRow( 0.0f );
+			for (int x = 0; x < gridSize; x += 8) {
+				const int i = idx( x, y );
+				const floatx8 p1 = floatx8::Load( px + i ), p2 = floatx8::Load( py + i );
+				const float2x8 Kp = StiffnessTimes( i, y, px, py );
+				const floatx8 q1 = fmadd( Kp.x, floatx8( implicitS ), p1 ), q2 = fmadd( Kp.y, floatx8( implicitS ), p2 );
+				q1.Store( qx + i ), q2.Store( qy + i );
+				pqRow = fmadd( p1, q1, fmadd( p2, q2, pqRow ) );
+			}
+			return hsum( pqRow );
+		} );
+		// dv += alpha p, r -= alpha q, z = M^-1 r
+		const float alpha = rz / pq;
+		const float rzNext = SumRows( [alpha]( const int y ) {
+			const floatx8 a( alpha );
+			floatx8 rzRow( 0.0f );
+			for (int x = 0; x < gridSize; x += 8) {
+				const int i = idx( x, y );
+				fmadd( a, floatx8::Load( px + i ), floatx8::Load( dvx + i ) ).Store( dvx + i );
+				fmadd( a, floatx8::Load( py + i ), floatx8::Load( dvy + i ) ).Store( dvy + i );
+				(floatx8::Load( rx + i ) - a * floatx8::Load( qx + i )).Store( rx + i );
+				(floatx8::Load( ry + i ) - a * floatx8::Load( qy + i )).Store( ry + i );
+				rzRow = rzRow + Precondition( i );
+			}
+			return hsum( rzRow );
+		} );
+		// p = z + beta p
+		const float beta = rzNext / rz;
+		rz = rzNext;
+		jm->ParallelFor( 1, gridSize, 8, [beta]( int first, int last, JobContext& ) {
+			const floatx8 b( beta );
+			for (int i = first * gridSize; i < last * gridSize; i += 8) {
+				fmadd( b, floatx8::Load( px + i ), floatx8::Load( zx + i ) ).Store( px + i );
+				fmadd( b, floatx8::Load( py + i ), floatx8::Load( zy + i ) ).Store( py + i );
+			}
+		} );
 	}
+	// move the points and record the tile bounds for obstacle collision; the top
+	// line has no velocity
+	jm->ParallelFor( 0, TILES * TILES, 4, []( int first, int last, JobContext& ) {
+		const floatx8 h( IMPLICITSTEP );
+		for (int tile = first; tile < last; tile++) {
+			const int x0 = (tile % TILES) * TILESIZE, y0 = (tile / TILES) * TILESIZE;
+			floatx8 minx( 1e30f ), miny( 1e30f ), maxx( -1e30f ), maxy( -1e30f );
+			for (int y = max( 1, y0 ); y < y0 + TILESIZE; y++) for (int x = x0; x < x0 + TILESIZE; x += 8) {
+				const int i = idx( x, y );
+				const floatx8 vx = floatx8::Load( velx + i ) + floatx8::Load( dvx + i ), vy = floatx8::Load( vely + i ) + floatx8::Load( dvy + i );
+				const floatx8 nx = fmadd( h, vx, floatx8::Load( posx + i ) ), ny = fmadd( h, vy, floatx8::Load( posy + i ) );
+				nx.Store( posx + i ), ny.Store( posy + i );
+				(nx - vx).Store( prevx + i ), (ny - vy).Store( prevy + i );
+				minx = min( nx, minx ), miny = min( ny, miny ), maxx = max( nx, maxx ), maxy = max( ny, maxy );
+			}
+			tileBounds[tile] = aabb( make_float3( hmin( minx ) - TILEMARGIN, hmin( miny ) - TILEMARGIN, 0 ),
+				make_float3( hmax( maxx ) + TILEMARGIN, hmax( maxy ) + TILEMARGIN, 0 ) );
+		}
+	} );
+	if (!obstacles.empty()) for (int tile = 0; tile < TILES * TILES; tile++)
+		obstacleBVH.OverlapQuery( tileBounds[tile], [tile]( uint o ) { CollideTile( tile, obstacles[o] ); } );
+	PinPoints();
+	SelfCollision();
+}
+
+// level of detail
+// Press L to simulate the grid at a resolution that varies per tile. Calm tiles
+// only simulate every 2nd or 4th point, linked with the summed rest lengths of
+// the links they skip; tiles that bend or stretch, touch an obstacle or hold
+// torn links keep all of their points. A tile bordering a finer tile takes the
+// finer spacing along that border, so every point on the fine side of the seam
+// has a partner, and no point hangs halfway along a coarse link. The simulated
+// points form a ClothMesh, rebuilt when levels change; levels are revisited
+// every LODINTERVAL frames. After each frame the skipped points are filled in
+// bilinearly from the corners of their coarse cell, so that DrawGrid draws the
+// full grid. The last row and column of tiles always keep all points, so every
+// coarse cell lies inside the grid. Links do not tear in this mode, and there
+// is no self-collision; when leaving it, the filled-in points are relaxed at
+// full resolution first, so that the grid finds few links to tear.
+// Bend and strain are measured between every LODMAXSTRIDE-th point, so that
+// they mean the same at every level, and so that the jitter of single points
+// in slack cloth does not count. Bend is the turn, in radians, between paths of
+// LODMAXSTRIDE links along a row or column. A tile simulates every s-th point
+// while its bend times s stays below LODBEND.
+#define LODINTERVAL 20
+#define LODMAXSTRIDE 4
+#define LODBEND 1.6f
+#define LODSTRAIN 1.1f				// a tile stretched beyond this keeps all of its points
+#define LODSETTLE 32				// iterations to settle the filled-in points when leaving
+ClothMesh lod;
+int lodStride[MAXTILES * MAXTILES];	// 1, 2 or 4
+GridField<int, 1 << MODE_LOD> lodVertex;	// grid point to mesh vertex, -1 when skipped
+vector<int> lodPoint;		// and back
+int lodFrame = 0;
+inline int Stride( const int x, const int y ) { return lodStride[(y / TILESIZE) * TILES + x / TILESIZE]; }
+static bool Simulated( const int x, const int y )
+{
+	const int s = Stride( x, y ), tx = x % TILESIZE, ty = y % TILESIZE;
+	if (x % s == 0 && y % s == 0) return true;
+	// seams: a border line takes the spacing of a finer neighbour
+	if (tx == 0 && x > 0 && Stride( x - 1, y ) < s && y % Stride( x - 1, y ) == 0) return true;
+	if (tx == TILESIZE - 1 && x < gridSize - 1 && Stride( x + 1, y ) < s && y % Stride( x + 1, y ) == 0) return true;
+	if (ty == 0 && y > 0 && Stride( x, y - 1 ) < s && x % Stride( x, y - 1 ) == 0) return true;
+	if (ty == TILESIZE - 1 && y < gridSize - 1 && Stride( x, y + 1 ) < s && x % Stride( x, y + 1 ) == 0) return true;
+	return false;
+}
+static void BuildLod()
+{
+	vector<float2> vertices;
+	vector<ClothMesh::Edge> edges;
+	lodPoint.clear();
+	for (int y = 0; y < gridSize; y++) for (int x = 0; x < gridSize; x++) {
+		const int i = idx( x, y );
+		lodVertex[i] = Simulated( x, y ) ? (int)lodPoint.size() : -1;
+		if (lodVertex[i] >= 0) lodPoint.push_back( i ), vertices.push_back( position( x, y ) );
+	}
+	// link each point to the next simulated point to its right and below it,
+	// across at most LODMAXSTRIDE intact links
+	for (int y = 0; y < gridSize; y++) for (int x = 0; x < gridSize; x++) if (lodVertex[idx( x, y )] >= 0) {
+		const uint v = lodVertex[idx( x, y )];
+		float rest = 0;
+		for (int d = 1; d <= LODMAXSTRIDE && x + d < gridSize; d++) {
+			const int k = idx( x + d - 1, y );
+			if (!(links[k] & LINK_RIGHT)) break;
+			rest += restlength[0][k];
+			if (lodVertex[k + 1] >= 0) { edges.push_back( { v, (uint)lodVertex[k + 1], rest, STRUCTURAL } ); break; }
+		}
+		rest = 0;
+		for (int d = 1; d <= LODMAXSTRIDE && y + d < gridSize; d++) {
+			const int k = idx( x, y + d - 1 );
+			if (!(links[k] & LINK_DOWN)) break;
+			rest += restlength[1][k];
+			if (lodVertex[k + gridSize] >= 0) { edges.push_back( { v, (uint)lodVertex[k + gridSize], rest, STRUCTURAL } ); break; }
+		}
+	}
+	lod.Build( vertices.data(), (uint)vertices.size(), edges.data(), (uint)edges.size() );
+	for (uint v = 0; v < lod.vertexCount; v++) {
+		lod.prevx[v] = prevx[lodPoint[v]], lod.prevy[v] = prevy[lodPoint[v]];
+		if (lodPoint[v] < gridSize) lod.Pin( v );
+	}
+}
+// rest length of the n links to the right of / below point i; zero if one is torn
+static float PathRest( const int i, const int link, const int n )
+{
+	float rest = 0;
+	for (int k = 0, j = i; k < n; k++, j += link == 0 ? 1 : gridSize) {
+		if (!(links[j] & (LINK_RIGHT << link))) return 0;
+		rest += restlength[link][j];
+	}
+	return rest;
+}
+// where a skipped point lies along its coarse link: by rest length rather than
+// by index, so that the links in between are stretched equally. Only used down
+// columns: vertical links can be very short, and the points of a column must
+// then share their horizontal fraction, or the offset between rows tears them.
+static float RestFraction( const int i, const int link, const int n, const int s )
+{
+	const float whole = PathRest( i, link, s );
+	return whole > 0 ? PathRest( i, link, n ) / whole : (float)n / s;
+}
+static bool UpdateLodLevels()
+{
+	// returns true if any tile changed level
+	bool changed = false;
+	for (int tile = 0; tile < TILES * TILES; tile++) {
+		const int tx = tile % TILES, ty = tile / TILES, x0 = tx * TILESIZE, y0 = ty * TILESIZE;
+		float2 bmin = make_float2( 1e30f ), bmax = make_float2( -1e30f );
+		bool torn = false;
+		for (int y = y0; y < y0 + TILESIZE; y++) for (int x = x0; x < x0 + TILESIZE; x++) {
+			const uint intact = (x < gridSize - 1 && y < gridSize - 1 ? LINK_RIGHT : 0) | (x > 0 && x < gridSize - 1 && y < gridSize - 1 ? LINK_DOWN : 0);
+			if ((links[idx( x, y )] & intact) != intact) torn = true;
+			bmin = fminf( bmin, position( x, y ) ), bmax = fmaxf( bmax, position( x, y ) );
+		}
+		float bend = 0, tileStrain = 0;
+		const int S = LODMAXSTRIDE;
+		for (int y = y0; y < y0 + TILESIZE; y += S) for (int x = x0; x < x0 + TILESIZE; x += S) {
+			const int i = idx( x, y );
+			const float2 p = position( x, y );
+			for (int link = 0; link < 2; link++) {
+				const int step = link == 0 ? 1 : gridSize, along = link == 0 ? x : y;
+				if (along + S >= gridSize) continue;
+				const float after = PathRest( i, link, S ), before = along >= S ? PathRest( i - S * step, link, S ) : 0;
+				const float2 next = make_float2( posx[i + S * step], posy[i + S * step] );
+				if (after > 0) tileStrain = max( tileStrain, length( next - p ) / after );
+				if (after > 0 && before > 0) {
+					const float2 prev = make_float2( posx[i - S * step], posy[i - S * step] );
+					bend = max( bend, length( prev + next - 2 * p ) * 2 / (before + after) );
+				}
+			}
+		}
+		bool contact = false;
+		obstacleBVH.OverlapQuery( aabb( make_float3( bmin - TILEMARGIN, 0 ), make_float3( bmax + TILEMARGIN, 0 ) ), [&contact]( uint ) { contact = true; } );
+		// coarsening needs a margin, so that tiles do not flip back and forth
+		int stride = 1;
+		if (!torn && !contact && tileStrain < LODSTRAIN && tx < TILES - 1 && ty < TILES - 1)
+			for (int s = 2; s <= LODMAXSTRIDE; s *= 2) if (bend * s < (s > lodStride[tile] ? 0.7f * LODBEND : LODBEND)) stride = s;
+		if (stride != lodStride[tile]) lodStride[tile] = stride, changed = true;
+	}
+	return changed;
+}
+static void StartLod()
+{
+	for (int tile = 0; tile < TILES * TILES; tile++) lodStride[tile] = 1;
+	UpdateLodLevels();
+	BuildLod();
+	lodFrame = 0;
+}
+static void StopLod()
+{
+	// back to all points; relax the filled-in points before the grid, which
+	// tears overstretched links, takes over
+	for (int tile = 0; tile < TILES * TILES; tile++) lodStride[tile] = 1;
+	BuildLod();
+	for (int i = 0; i < LODSETTLE; i++) lod.Relax();
+	for (uint v = 0; v < lod.vertexCount; v++) {
+		const int i = lodPoint[v];
+		prevx[i] += lod.x[v] - posx[i], prevy[i] += lod.y[v] - posy[i]; // keep the velocity
+		posx[i] = lod.x[v], posy[i] = lod.y[v];
+	}
+}
+static void LodFrame()
+{
+	if (++lodFrame % LODINTERVAL == 0 && UpdateLodLevels()) BuildLod();
+	const floatx8 zero( 0.0f );
+	for (int steps = 0; steps < 3; steps++) {
+		wind.Update( make_float2( 0.0015f * (0.02f + magic), 0.0015f * 0.12f ) );
+		lod.Integrate( make_float2( 0, 0.003f ) );
+		for (uint v = 0; v < lod.vertexCount; v += 8) {
+			const floatx8 x8 = floatx8::Load( lod.x + v ), y8 = floatx8::Load( lod.y + v );
+			const maskx8 free = floatx8::Load( lod.invMass + v ) > zero;
+			const float2x8 push = wind.Sample( x8, y8 );
+			select( free, x8 + push.x, x8 ).Store( lod.x + v ), select( free, y8 + push.y, y8 ).Store( lod.y + v );
+		}
+		magic += 0.0002f;
+		// two passes per iteration, as the grid does
+		for (int i = 0; i < 8; i++) {
+			lod.Relax();
+			for (const Obstacle& o : obstacles) for (uint v = 0; v < lod.vertexCount; v += 8) {
+				const float2x8 p = ProjectOut( o, float2x8( floatx8::Load( lod.x + v ), floatx8::Load( lod.y + v ) ) );
+				p.x.Store( lod.x + v ), p.y.Store( lod.y + v );
+			}
+		}
+	}
+	// copy the simulated points back, then fill in the others
+	JobManager* jm = JobManager::GetJobManager();
+	jm->ParallelFor( 0, (int)lod.vertexCount, 1024, []( int first, int last, JobContext& ) {
+		for (int v = first; v < last; v++) {
+			const int i = lodPoint[v];
+			posx[i] = lod.x[v], posy[i] = lod.y[v], prevx[i] = lod.prevx[v], prevy[i] = lod.prevy[v];
+		}
+	} );
+	jm->ParallelFor( 0, gridSize, 8, []( int first, int last, JobContext& ) {
+		for (int y = first; y < last; y++) for (int x = 0; x < gridSize; x++) if (lodVertex[idx( x, y )] < 0) {
+			const int s = Stride( x, y ), a = idx( x - x % s, y - y % s ), b = a + s, c = a + s * gridSize, d = c + s;
+			const float u = (float)(x % s) / s, w = RestFraction( idx( x, y - y % s ), 1, y % s, s );
+			const float wa = (1 - u) * (1 - w), wb = u * (1 - w), wc = (1 - u) * w, wd = u * w;
+			float* fields[4] = { posx, posy, prevx, prevy };
+			for (float* f : fields) f[idx( x, y )] = f[a] * wa + f[b] * wb + f[c] * wc + f[d] * wd;
+		}
+	} );
+}
+
+// stability monitor
+// After every step of the grid cloth, the velocity of each point is measured,
+// eight points at a time with tiles in parallel, and reduced to the kinetic
+// energy and the top speed of each tile. A tile is unstable when one of its
+// points moves faster than MAXSAFESPEED per unit of time, which links and wind
+// never come close to, or has stopped being a number. The cloth as a whole is
+// diverging when its energy grows by more than ENERGYGROWTH per step for
+// GROWTHSTEPS steps in a row; tiles that hold several times their share of the
+// energy then count as unstable as well. Either shows up well before positions
+// overflow. Points that came loose or fell far below the screen are left out:
+// they may fall as fast as they like. So is the grabbed point, which follows the
+// cursor as fast as it is dragged. Press R to choose the response:
+// - clamp: velocities in unstable tiles are scaled back to CLAMPSPEED, and
+//   points that are no longer numbers return to the snapshot, at rest. This
+//   stays well below MAXSAFESPEED, so that a fragment that tore off and falls
+//   freely does not trip the monitor again every step;
+// - roll back: the grid returns to the snapshot, which is taken every
+//   SNAPSHOTINTERVAL stable steps;
+// - log: the event is printed and the simulation carries on.
+// Events are printed to the console for each policy.
+#define MAXSAFESPEED 4.0f
+#define NANSPEED 1e10f // tile speeds above this come from points that are no longer numbers
+#define GRABREACH 2 // points this close to the grabbed one are dragged along
+#define CLAMPSPEED 1.0f
+#define ENERGYGROWTH 1.5f
+#define GROWTHSTEPS 4
+#define ENERGYFLOOR 1000.0f
+#define SNAPSHOTINTERVAL 60
+enum { RECOVER_CLAMP = 0, RECOVER_ROLLBACK, RECOVER_LOG };
+const char* recoveryName[3] = { "clamp", "roll back", "log" };
+int recovery = RECOVER_CLAMP;
+float tileEnergy[MAXTILES * MAXTILES], tileSpeed[MAXTILES * MAXTILES];
+bool tileUnstable[MAXTILES * MAXTILES];
+float energy = 0, topSpeed = 0, lastEnergy = 0;
+int growthSteps = 0, stableSteps = 0;
+uint instabilities = 0;
+GridField<float, 1 << MODE_GRID> snapshot[5];	// posx, posy, prevx, prevy and links
+uint snapshotTorn = 0;
+float snapshotMagic = 0, snapshotDt = 1;
+bool haveSnapshot = false;
+static void TakeSnapshot()
+{
+	float* state[5] = { posx, posy, prevx, prevy, (float*)(uint*)links };
+	for (int f = 0; f < 5; f++) memcpy( snapshot[f], state[f], gridSize * gridSize * sizeof( float ) );
+	snapshotTorn = tornLinks, snapshotMagic = magic, snapshotDt = lastDt, haveSnapshot = true;
+}
+static void RestoreSnapshot()
+{
+	float* state[5] = { posx, posy, prevx, prevy, (float*)(uint*)links };
+	for (int f = 0; f < 5; f++) memcpy( state[f], snapshot[f], gridSize * gridSize * sizeof( float ) );
+	tornLinks = snapshotTorn, magic = snapshotMagic, lastDt = snapshotDt;
+}
+static void ClampTiles( const float dt )
+{
+	JobManager::GetJobManager()->ParallelFor( 0, TILES * TILES, 4, [dt]( int first, int last, JobContext& ) {
+		const floatx8 limit2( CLAMPSPEED * CLAMPSPEED * dt * dt ), one( 1.0f ), huge( 1e30f );
+		for (int tile = first; tile < last; tile++) if (tileUnstable[tile]) {
+			const int x0 = (tile % TILES) * TILESIZE, y0 = (tile / TILES) * TILESIZE;
+			for (int y = y0; y < y0 + TILESIZE; y++) for (int x = x0; x < x0 + TILESIZE; x += 8) {
+				const int i = idx( x, y );
+				const float2x8 p( floatx8::Load( posx + i ), floatx8::Load( posy + i ) );
+				const float2x8 v = p - float2x8( floatx8::Load( prevx + i ), floatx8::Load( prevy + i ) );
+				const floatx8 v2 = dot( v, v );
+				const float2x8 prev = p - v * select( v2 > limit2, sqrt( limit2 / v2 ), one );
+				prev.x.Store( prevx + i ), prev.y.Store( prevy + i );
+				const maskx8 lost = ~(v2 < huge);
+				if (!haveSnapshot || !any( lost )) continue;
+				const floatx8 sx = floatx8::Load( snapshot[0] + i ), sy = floatx8::Load( snapshot[1] + i );
+				const floatx8 nx = select( lost, sx, floatx8::Load( posx + i ) ), ny = select( lost, sy, floatx8::Load( posy + i ) );
+				nx.Store( posx + i ), ny.Store( posy + i );
+				select( lost, sx, prev.x ).Store( prevx + i ), select( lost, sy, prev.y ).Store( prevy + i );
+			}
+		}
+	} );
+}
+static void MonitorStability( const float dt )
+{
+	ALIGN( 32 ) static const float lane[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+	JobManager::GetJobManager()->ParallelFor( 0, TILES * TILES, 4, [dt]( int first, int last, JobContext& ) {
+		const floatx8 zero( 0.0f ), huge( 1e30f ), bottom( 2.0f * SCRHEIGHT ), scale( 1 / (dt * dt) );
+		for (int tile = first; tile < last; tile++) {
+			const int x0 = (tile % TILES) * TILESIZE, y0 = (tile / TILES) * TILESIZE;
+			floatx8 e( 0.0f ), top( 0.0f );
+			for (int y = y0; y < y0 + TILESIZE; y++) for (int x = x0; x < x0 + TILESIZE; x += 8) {
+				const int i = idx( x, y );
+				const floatx8 x8 = floatx8::Load( posx + i ), y8 = floatx8::Load( posy + i );
+				const floatx8 vx = x8 - floatx8::Load( prevx + i ), vy = y8 - floatx8::Load( prevy + i );
+				// squared speed per unit of time; NaN and overflow become huge
+				floatx8 v2 = select( Attached( i, y ) & ~(y8 > bottom), (vx * vx + vy * vy) * scale, zero );
+				// the grabbed point moves at cursor speed, like the pinned points it is not free
+				if ((uint)(grabbed - i) < 8) v2 = select( floatx8::Load( lane ) == floatx8( (float)(grabbed - i) ), zero, v2 );
+				const maskx8 finite = v2 < huge;
+				e = e + select( finite, v2, zero ), top = max( select( finite, v2, huge ), top );
+			}
+			tileEnergy[tile] = 0.5f * hsum( e ), tileSpeed[tile] = sqrtf( hmax( top ) );
+		}
+	} );
+	double sum = 0;
+	topSpeed = 0;
+	for (int tile = 0; tile < TILES * TILES; tile++) sum += tileEnergy[tile], topSpeed = max( topSpeed, tileSpeed[tile] );
+	energy = (float)sum;
+	growthSteps = energy > ENERGYFLOOR && energy > lastEnergy * ENERGYGROWTH ? growthSteps + 1 : 0;
+	lastEnergy = energy;
+	const bool diverging = growthSteps >= GROWTHSTEPS;
+	const float share = 4 * energy / (TILES * TILES);
+	// the points around the grabbed one move with the cursor; in their tiles only NaNs count
+	int gx0 = 1, gx1 = 0, gy0 = 1, gy1 = 0;
+	if (grabbed >= 0) {
+		const int gx = grabbed % gridSize, gy = grabbed / gridSize;
+		gx0 = max( 0, gx - GRABREACH ) / TILESIZE, gx1 = min( gridSize - 1, gx + GRABREACH ) / TILESIZE;
+		gy0 = max( 0, gy - GRABREACH ) / TILESIZE, gy1 = min( gridSize - 1, gy + GRABREACH ) / TILESIZE;
+	}
+	int unstable = 0;
+	for (int tile = 0; tile < TILES * TILES; tile++) {
+		const int tx = tile % TILES, ty = tile / TILES;
+		const bool dragged = tx >= gx0 && tx <= gx1 && ty >= gy0 && ty <= gy1;
+		tileUnstable[tile] = tileSpeed[tile] > (dragged ? NANSPEED : MAXSAFESPEED) || (diverging && tileEnergy[tile] > share);
+		unstable += tileUnstable[tile];
+	}
+	if (!unstable) {
+		if (stableSteps++ % SNAPSHOTINTERVAL == 0) TakeSnapshot();
+		return;
+	}
+	printf( "stability monitor: %d unstable tiles, energy %.1f, top speed %.1f%s: %s\n", unstable, energy,
+		topSpeed, diverging ? ", diverging" : "", recoveryName[recovery] );
+	instabilities++, stableSteps = growthSteps = 0;
+	if (recovery == RECOVER_ROLLBACK && haveSnapshot) RestoreSnapshot();
+	else if (recovery != RECOVER_LOG) ClampTiles( dt );
+}
+
+// grid solver
+// The Verlet step of the grid is compiled for each of the common widths in
+// gridSteps, so that strides and trip counts are constants, and once for any
+// width (W = 0), which reads gridSize instead. ResizeGrid picks the step for the
+// new size from the table. Returns the largest squared distance an attached
+// point moved.
+template <int W> static float Step( const float dt )
+{
+	static void (*const solve[3])() = { Stencil4<W>::Solve, Stencil8<W>::Solve, Stencil12<W>::Solve };
+	const int tiles = Width<W>() / TILESIZE;
+	// verlet integration; apply gravity and wind, eight points at a time;
+	// velocity is rescaled when the step length changes
+	wind.Update( make_float2( 0.0015f * (0.02f + magic), 0.0015f * 0.12f ) * (dt * dt), dt );
+	// processed per tile, to record the tile bounds for obstacle collision
+	const floatx8 gravity( 0.003f * dt * dt ), inertia( dt / lastDt ), zero( 0.0f );
+	floatx8 move2( 0.0f );
+	for (int tile = 0; tile < tiles * tiles; tile++) {
+		const int x0 = (tile % tiles) * TILESIZE, y0 = (tile / tiles) * TILESIZE;
+		floatx8 minx( 1e30f ), miny( 1e30f ), maxx( -1e30f ), maxy( -1e30f );
+		for (int y = y0; y < y0 + TILESIZE; y++) for (int x = x0; x < x0 + TILESIZE; x += 8) {
+			const int i = Idx<W>( x, y );
+			const floatx8 x8 = floatx8::Load( posx + i ), y8 = floatx8::Load( posy + i );
+			const floatx8 ox = floatx8::Load( prevx + i ), oy = floatx8::Load( prevy + i );
+			const float2x8 push = wind.Sample( x8, y8 );
+			const floatx8 nx = x8 + (x8 - ox) * inertia + push.x, ny = y8 + ((y8 - oy) * inertia + gravity) + push.y;
+			nx.Store( posx + i ), ny.Store( posy + i );
+			x8.Store( prevx + i ), y8.Store( prevy + i );
+			// the free fall of loose points does not count towards the step size
+			move2 = max( select( Attached<W>( i, y ), (nx - x8) * (nx - x8) + (ny - y8) * (ny - y8), zero ), move2 );
+			// new values go first: min and max then ignore NaNs of exploded points
+			minx = min( nx, minx ), miny = min( ny, miny ), maxx = max( nx, maxx ), maxy = max( ny, maxy );
+		}
+		tileBounds[tile] = aabb( make_float3( hmin( minx ) - TILEMARGIN, hmin( miny ) - TILEMARGIN, 0 ),
+			make_float3( hmax( maxx ) + TILEMARGIN, hmax( maxy ) + TILEMARGIN, 0 ) );
+	}
+	lastDt = dt;
+
+	magic += 0.0002f * dt; // slowly increases the chance of anomalies
+	// apply constraints; 4 simulation steps: do not change this number.
+	for (int i = 0; i < 4; i++) {
+		// the scalar loop this replaces visited every link from both of its end
+		// points; two sweeps per iteration keep the cloth as stiff as it was
+		for (int sweep = 0; sweep < 2; sweep++) solve[stencil]();
+		// push points out of obstacles
+		if (!obstacles.empty()) for (int tile = 0; tile < tiles * tiles; tile++)
+			obstacleBVH.OverlapQuery( tileBounds[tile], [tile]( uint o ) { CollideTile( tile, obstacles[o] ); } );
+		// fixed line of points is fixed.
+		PinPoints();
+	}
+	// keep the cloth from passing through itself
+	SelfCollision();
+	MonitorStability( dt );
+	return hmax( move2 );
+}
+struct GridStep { int width; float (*step)( const float dt ); };
+const GridStep gridSteps[] = { { 256, Step<256> }, { 512, Step<512> }, { 1024, Step<1024> }, { 2048, Step<2048> }, { 4096, Step<4096> } };
+float (*gridStep)( const float dt ) = Step<0>;
+static void ResizeGrid( const int size )
+{
+	FATALERROR_IF( size % TILESIZE || size < 2 * TILESIZE || size > MAXGRIDSIZE, "Unsupported cloth size %i.", size );
+	gridSize = size;
+	GridArray::ResizeAll();
+	gridStep = Step<0>;
+	for (const GridStep& s : gridSteps) if (s.width == size) gridStep = s.step;
+	haveSnapshot = false, stableSteps = growthSteps = 0;
+}
+
+void Game::Init() {
+	ResizeGrid( DEFAULTGRIDSIZE );
+	InitGrid();
+	// something for the bottom of the cloth to settle on as it sags
+	ClearObstacles();
+	AddObstacle( Obstacle::Sphere( make_float2( 640, 640 ), 60 ) );
+	AddObstacle( Obstacle::Capsule( make_float2( 160, 610 ), make_float2( 400, 640 ), 20 ) );
+	AddObstacle( Obstacle::Box( make_float2( 1000, 650 ), make_float2( 100, 40 ) ) );
+	BuildMeshCloth();
+}
+
+void Game::KeyDown( int key ) {
+	// the 3D cloth is drawn via the grid arrays, so the grid restarts after it
+	const int previous = mode;
+	if (key == GLFW_KEY_G) {
+		// a new size starts over with a fresh grid cloth
+		mode = MODE_GRID, grabbed = -1;
+		ResizeGrid( gridSize < 1024 ? gridSize * 2 : 128 );
+		InitGrid();
+		return;
+	}
+	if (key == GLFW_KEY_M) mode = mode == MODE_MESH ? MODE_GRID : MODE_MESH;
+	if (key == GLFW_KEY_3) mode = mode == MODE_3D ? MODE_GRID : MODE_3D;
+	if (key == GLFW_KEY_I) mode = mode == MODE_IMPLICIT ? MODE_GRID : MODE_IMPLICIT;
+	if (key == GLFW_KEY_L) mode = mode == MODE_LOD ? MODE_GRID : MODE_LOD;
+	if (key == GLFW_KEY_A) adaptive = !adaptive;
+	if (key == GLFW_KEY_H) heatmap = !heatmap;
+	if (key == GLFW_KEY_R) recovery = (recovery + 1) % 3;
+	if (key == GLFW_KEY_C) stencil = (stencil + 1) % 3;
+	if (mode != previous) grabbed = -1;
+	if (previous == MODE_LOD && mode != MODE_LOD) StopLod();
+	// fields of the modes left behind go, those of the new mode start zeroed
+	if (mode != previous) GridArray::ModeChanged(), haveSnapshot = false;
+	if (mode == MODE_3D && previous != MODE_3D) Build3DCloth();
+	if (previous == MODE_3D && mode != MODE_3D) InitGrid();
+	if (mode == MODE_LOD && previous != MODE_LOD) StartLod();
+}
+
+void Game::MouseDown( int button ) {
+	// only the grid modes keep the points in the grid arrays
+	if (button == GLFW_MOUSE_BUTTON_LEFT && (mode == MODE_GRID || mode == MODE_IMPLICIT))
+		grabbed = Pick( make_float2( (float)mousePos.x, (float)mousePos.y ) );
+}
+
+void Game::MouseUp( int button ) {
+	if (button == GLFW_MOUSE_BUTTON_LEFT) grabbed = -1;
+}
+
+void Game::Simulation() {
+	grabPos = make_float2( (float)mousePos.x, (float)mousePos.y );
+	if (mode == MODE_MESH) {
+		for (int steps = 0; steps < 3; steps++) {
+			mesh.Integrate( make_float2( 0, 0.003f ) );
+			for (int i = 0; i < 4; i++) mesh.Relax();
+		}
+		return;
+	}
+	if (mode == MODE_3D) {
+		for (int steps = 0; steps < 3; steps++) {
+			// gravity, and a breeze that slowly turns
+			breeze += 0.01f;
+			cloth3D.Integrate( make_float3( 0.0006f * sinf( breeze ), -0.003f, 0.0008f * cosf( 0.7f * breeze ) ) );
+			for (int i = 0; i < 4; i++) cloth3D.Relax();
+		}
+		ProjectPositions( cloth3D.x, cloth3D.y, cloth3D.z, posx, posy, gridSize * gridSize, camera );
+		return;
+	}
+	if (mode == MODE_IMPLICIT) {
+		ImplicitStep();
+		lastDt = 1; // its velocities are per unit of time
+		return;
+	}
+	if (mode == MODE_LOD) {
+		LodFrame();
+		lastDt = 1;
+		return;
+	}
+	// simulation is exected three times per frame; do not change this. In
+	// adaptive mode the same time is covered in a varying number of steps.
+	substeps = adaptive ? AdaptiveSubsteps() : 3;
+	const float dt = 3.0f / substeps;
+	Timer timer;
+	float moved = 0;
+	for (int steps = 0; steps < substeps; steps++) moved = max( moved, gridStep( dt ) );
+	maxSpeed = sqrtf( moved ) / dt;
+	stepCost = 0.9f * stepCost + 0.1f * timer.elapsed() * 1000 / substeps;
 }
 
 void Game::Tick( float a_DT ) {
@@ -149,11 +1463,13 @@ void Game::Tick( float a_DT ) {
 	Timer tm;
 	tm.reset();
 	Simulation();
+	if (mode == MODE_GRID || mode == MODE_IMPLICIT) BuildPickGrid();
+	if (mode != MODE_MESH && mode != MODE_3D) AnalyzeStrain();
 	float elapsed1 = tm.elapsed();
 
 	// draw the grid
 	tm.reset();
-	DrawGrid();
+	if (mode == MODE_MESH) DrawMesh(); else if (heatmap && mode != MODE_3D) DrawStrain(); else DrawGrid();
 	float elapsed2 = tm.elapsed();
 
 	// display statistics
@@ -162,4 +1478,21 @@ void Game::Tick( float a_DT ) {
 	screen->Print( t, 2, SCRHEIGHT - 24, 0xffffff );
 	sprintf( t, "                       rendering: %5.1f ms", elapsed2 * 1000 );
 	screen->Print( t, 2, SCRHEIGHT - 14, 0xffffff );
+	sprintf( t, "                      torn links: %5u", tornLinks.load() );
+	screen->Print( t, 2, SCRHEIGHT - 34, 0xffffff );
+	screen->Print( "M: mesh cloth with a hole, 3: 3D cloth, I: implicit integration, L: level of detail, H: strain, drag: pull", 2, SCRHEIGHT - 44, 0xffffff );
+	sprintf( t, "A: adaptive steps %s (%d steps), C: %d neighbours, G: %d x %d points", adaptive ? "on" : "off", substeps, 4 * (stencil + 1), gridSize, gridSize );
+	screen->Print( t, 2, SCRHEIGHT - 54, 0xffffff );
+	if (mode != MODE_MESH && mode != MODE_3D) {
+		sprintf( t, "strain: max %.2f, mean %.3f, %u links near tearing", strainStats.max, strainStats.mean, strainStats.histogram[STRAINBINS - 1] );
+		screen->Print( t, 2, SCRHEIGHT - 64, 0xffffff );
+	}
+	if (mode == MODE_GRID) {
+		sprintf( t, "R: on instability %s; %u events, energy %.0f, top speed %.2f", recoveryName[recovery], instabilities, energy, topSpeed );
+		screen->Print( t, 2, SCRHEIGHT - 74, 0xffffff );
+	}
+	if (mode == MODE_LOD) {
+		sprintf( t, "simulating %u of %d points", lod.vertexCount, gridSize * gridSize );
+		screen->Print( t, 2, SCRHEIGHT - 74, 0xffffff );
+	}
 }
\ No newline at end of file
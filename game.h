@@ -7,22 +7,39 @@
 namespace Tmpl8
 {
 
+// obstacle shapes for the cloth to collide with; see game.cpp
+struct Obstacle
+{
+	enum { SPHERE = 0, CAPSULE, BOX };
+	static Obstacle Sphere( const float2 centre, const float radius ) { return Obstacle{ SPHERE, centre, centre, radius }; }
+	static Obstacle Capsule( const float2 a, const float2 b, const float radius ) { return Obstacle{ CAPSULE, a, b, radius }; }
+	static Obstacle Box( const float2 centre, const float2 halfSize ) { return Obstacle{ BOX, centre, halfSize, 0 }; }
+	aabb Bounds() const;
+	int type;
+	float2 a, b;	// sphere: centre (twice); capsule: segment end points; box: centre and half size
+	float radius;	// sphere and capsule only
+};
+
 class Game : public TheApp
 {
 public:
 	// game flow methods
 	void Init();
 	void DrawGrid();
+	void DrawMesh();
+	void DrawStrain();
 	void Simulation();
 	void Tick( float deltaTime );
+	void AddObstacle( const Obstacle& obstacle );
+	void ClearObstacles();
 	void Shutdown() { /* implement if you want to do something on exit */ }
 	// input handling
-	void MouseUp( int ) { /* implement if you want to detect mouse button presses */ }
-	void MouseDown( int ) { /* implement if you want to detect mouse button presses */ }
+	void MouseUp( int button );
+	void MouseDown( int button );
 	void MouseMove( int x, int y ) { mousePos.x = x, mousePos.y = y; }
 	void MouseWheel( float ) { /* implement if you want to handle the mouse wheel */ }
 	void KeyUp( int ) { /* implement if you want to handle keys */ }
-	void KeyDown( int ) { /* implement if you want to handle keys */ }
+	void KeyDown( int key );
 	// data members
 	int2 mousePos;
 };
@@ -0,0 +1,210 @@
+// Template, IGAD version 3
+// Get the latest version from: https://github.com/jbikker/tmpl8
+// IGAD/NHTV/UU - Jacco Bikker - 2006-2023
+
+#include "precomp.h"
+
+// bounding volume hierarchy, see bvh.h
+#define BINS 8
+
+BVH::~BVH()
+{
+	FREE64( primIdx );
+	FREE64( nodes );
+	FREE64( quadNodes );
+}
+
+void BVH::Build( const aabb* primBounds, const uint count )
+{
+	// (re)allocate; a binary tree over N primitives has at most 2N - 1 nodes, plus the unused node 1
+	if (count > primCapacity || !nodes)
+	{
+		FREE64( primIdx ), FREE64( nodes ), FREE64( quadNodes );
+		primCapacity = max( 1u, count );
+		primIdx = (uint*)MALLOC64( primCapacity * sizeof( uint ) );
+		nodes = (Node*)MALLOC64( primCapacity * 2 * sizeof( Node ) );
+		quadNodes = 0;
+	}
+	primCount = count, nodesUsed = quadNodesUsed = 0;
+	if (count == 0) return;
+	float3* centroids = (float3*)MALLOC64( count * sizeof( float3 ) );
+	for (uint i = 0; i < count; i++)
+	{
+		primIdx[i] = i;
+		centroids[i] = make_float3( primBounds[i].Center( 0 ), primBounds[i].Center( 1 ), primBounds[i].Center( 2 ) );
+	}
+	Node& root = nodes[0];
+	root.leftFirst = 0, root.count = count;
+	nodesUsed = 2; // skip node 1, so that sibling pairs are 64-byte aligned
+	UpdateNodeBounds( 0, primBounds );
+	Subdivide( 0, primBounds, centroids );
+	FREE64( centroids );
+}
+
+void BVH::Build( const float3* triVerts, const uint triCount )
+{
+	aabb* bounds = (aabb*)MALLOC64( max( 1u, triCount ) * sizeof( aabb ) );
+	for (uint i = 0; i < triCount; i++)
+	{
+		bounds[i].Reset();
+		for (int j = 0; j < 3; j++) bounds[i].Grow( triVerts[i * 3 + j] );
+	}
+	Build( bounds, triCount );
+	FREE64( bounds );
+}
+
+void BVH::Refit( const aabb* primBounds )
+{
+	// children are always stored after their parent, so a reverse sweep visits them first
+	for (int i = (int)nodesUsed - 1; i >= 0; i--) if (i != 1)
+	{
+		Node& node = nodes[i];
+		if (node.IsLeaf()) { UpdateNodeBounds( i, primBounds ); continue; }
+		const Node& left = nodes[node.leftFirst], &right = nodes[node.leftFirst + 1];
+		node.bmin = fminf( left.bmin, right.bmin );
+		node.bmax = fmaxf( left.bmax, right.bmax );
+	}
+}
+
+void BVH::UpdateNodeBounds( const uint nodeIdx, const aabb* primBounds )
+{
+	Node& node = nodes[nodeIdx];
+	aabb bounds;
+	bounds.Reset();
+	for (uint i = 0; i < node.count; i++) bounds.Grow( primBounds[primIdx[node.leftFirst + i]] );
+	node.bmin = make_float3( bounds.bmin[0], bounds.bmin[1], bounds.bmin[2] );
+	node.bmax = make_float3( bounds.bmax[0], bounds.bmax[1], bounds.bmax[2] );
+}
+
+float BVH::FindBestSplitPlane( const Node& node, const aabb* primBounds, const float3* centroids, int& axis, float& splitPos ) const
+{
+	float bestCost = 1e30f;
+	for (int a = 0; a < 3; a++)
+	{
+		float boundsMin = 1e30f, boundsMax = -1e30f;
+		for (uint i = 0; i < node.count; i++)
+		{
+			const float c = centroids[primIdx[node.leftFirst + i]].cell[a];
+			boundsMin = min( boundsMin, c ), boundsMax = max( boundsMax, c );
+		}
+		if (boundsMin == boundsMax) continue;
+		// populate the bins
+		aabb bin[BINS];
+		uint binCount[BINS] = {};
+		for (int i = 0; i < BINS; i++) bin[i].Reset();
+		const float scale = BINS / (boundsMax - boundsMin);
+		for (uint i = 0; i < node.count; i++)
+		{
+			const uint prim = primIdx[node.leftFirst + i];
+			const int binIdx = min( BINS - 1, (int)((centroids[prim].cell[a] - boundsMin) * scale) );
+			binCount[binIdx]++;
+			bin[binIdx].Grow( primBounds[prim] );
+		}
+		// gather data for the BINS - 1 planes between the bins
+		float leftArea[BINS - 1], rightArea[BINS - 1];
+		uint leftCount[BINS - 1], rightCount[BINS - 1];
+		aabb leftBox, rightBox;
+		leftBox.Reset(), rightBox.Reset();
+		uint leftSum = 0, rightSum = 0;
+		for (int i = 0; i < BINS - 1; i++)
+		{
+			leftSum += binCount[i], leftCount[i] = leftSum;
+			leftBox.Grow( bin[i] ), leftArea[i] = leftBox.Area();
+			rightSum += binCount[BINS - 1 - i], rightCount[BINS - 2 - i] = rightSum;
+			rightBox.Grow( bin[BINS - 1 - i] ), rightArea[BINS - 2 - i] = rightBox.Area();
+		}
+		// calculate SAH cost for the planes
+		const float planeStep = (boundsMax - boundsMin) / BINS;
+		for (int i = 0; i < BINS - 1; i++)
+		{
+			const float planeCost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+			if (planeCost < bestCost) axis = a, splitPos = boundsMin + planeStep * (i + 1), bestCost = planeCost;
+		}
+	}
+	return bestCost;
+}
+
+void BVH::Subdivide( const uint nodeIdx, const aabb* primBounds, const float3* centroids )
+{
+	// terminate recursion if splitting does not pay off
+	Node& node = nodes[nodeIdx];
+	int axis = 0;
+	float splitPos = 0;
+	const float splitCost = FindBestSplitPlane( node, primBounds, centroids, axis, splitPos );
+	const float3 e = node.bmax - node.bmin;
+	const float noSplitCost = node.count * (e.x * e.y + e.y * e.z + e.z * e.x);
+	if (splitCost >= noSplitCost) return;
+	// in-place partition
+	int i = node.leftFirst, j = i + node.count - 1;
+	while (i <= j)
+	{
+		if (centroids[primIdx[i]].cell[axis] < splitPos) i++;
+		else Swap( primIdx[i], primIdx[j--] );
+	}
+	// abort split if one of the sides is empty
+	const uint leftCount = i - node.leftFirst;
+	if (leftCount == 0 || leftCount == node.count) return;
+	// create child nodes
+	const uint leftChildIdx = nodesUsed++, rightChildIdx = nodesUsed++;
+	nodes[leftChildIdx].leftFirst = node.leftFirst, nodes[leftChildIdx].count = leftCount;
+	nodes[rightChildIdx].leftFirst = i, nodes[rightChildIdx].count = node.count - leftCount;
+	node.leftFirst = leftChildIdx, node.count = 0;
+	UpdateNodeBounds( leftChildIdx, primBounds );
+	UpdateNodeBounds( rightChildIdx, primBounds );
+	// recurse
+	Subdivide( leftChildIdx, primBounds, centroids );
+	Subdivide( rightChildIdx, primBounds, centroids );
+}
+
+void BVH::BuildQuad()
+{
+	// every quad node consumes at least one interior binary node, so nodesUsed is a safe upper bound
+	FREE64( quadNodes );
+	quadNodes = (QuadNode*)MALLOC64( max( 1u, nodesUsed ) * sizeof( QuadNode ) );
+	quadNodesUsed = 0;
+	if (nodesUsed) CollapseNode( 0 );
+}
+
+uint BVH::CollapseNode( const uint nodeIdx )
+{
+	// gather up to four children by repeatedly opening the interior child with the largest area
+	uint slot[4], slots = 0;
+	const Node& node = nodes[nodeIdx];
+	if (node.IsLeaf()) slot[slots++] = nodeIdx; // single-leaf tree
+	else slot[0] = node.leftFirst, slot[1] = node.leftFirst + 1, slots = 2;
+	while (slots < 4)
+	{
+		int best = -1;
+		float bestArea = -1;
+		for (uint i = 0; i < slots; i++)
+		{
+			const Node& n = nodes[slot[i]];
+			if (n.IsLeaf()) continue;
+			const float3 e = n.bmax - n.bmin;
+			const float area = e.x * e.y + e.y * e.z + e.z * e.x;
+			if (area > bestArea) best = i, bestArea = area;
+		}
+		if (best == -1) break;
+		const uint opened = slot[best];
+		slot[best] = nodes[opened].leftFirst, slot[slots++] = nodes[opened].leftFirst + 1;
+	}
+	// fill the quad node; recursion happens after, quadNodes is allocated up front
+	const uint quadIdx = quadNodesUsed++;
+	QuadNode& quad = quadNodes[quadIdx];
+	for (uint i = 0; i < 4; i++)
+	{
+		if (i >= slots)
+		{
+			quad.bminx[i] = quad.bminy[i] = quad.bminz[i] = 1e30f;
+			quad.bmaxx[i] = quad.bmaxy[i] = quad.bmaxz[i] = -1e30f;
+			quad.child[i] = quad.count[i] = 0;
+			continue;
+		}
+		const Node& n = nodes[slot[i]];
+		quad.bminx[i] = n.bmin.x, quad.bminy[i] = n.bmin.y, quad.bminz[i] = n.bmin.z;
+		quad.bmaxx[i] = n.bmax.x, quad.bmaxy[i] = n.bmax.y, quad.bmaxz[i] = n.bmax.z;
+		quad.child[i] = n.leftFirst, quad.count[i] = n.count;
+	}
+	for (uint i = 0; i < slots; i++) if (!nodes[slot[i]].IsLeaf()) quadNodes[quadIdx].child[i] = CollapseNode( slot[i] );
+	return quadIdx;
+}
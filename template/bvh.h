@@ -0,0 +1,111 @@
+// Template, IGAD version 3
+// Get the latest version from: https://github.com/jbikker/tmpl8
+// IGAD/NHTV/UU - Jacco Bikker - 2006-2023
+
+#pragma once
+
+namespace Tmpl8
+{
+
+// bounding volume hierarchy
+// Built over one aabb per primitive, so it works for triangles, spheres,
+// capsules or anything else that has bounds. Construction uses binned SAH.
+// Nodes are 32 bytes; siblings are stored next to each other, starting at
+// index 2, so that each pair shares a cache line. After Build or Refit,
+// BuildQuad collapses the tree into a 4-wide BVH (QBVH) with SoA child bounds,
+// which the Quad* queries test four at a time. Queries call 'visit' with the
+// index of every primitive whose bounds contain the point or overlap the box;
+// the caller does the exact test.
+class BVH
+{
+public:
+	struct Node
+	{
+		float3 bmin; uint leftFirst;	// interior: index of the left child; leaf: first entry in primIdx
+		float3 bmax; uint count;		// number of primitives; 0 for interior nodes
+		bool IsLeaf() const { return count > 0; }
+	};
+	struct ALIGN( 64 ) QuadNode
+	{
+		float bminx[4], bminy[4], bminz[4];	// child bounds; unused slots hold an
+		float bmaxx[4], bmaxy[4], bmaxz[4];	// inverted box that never overlaps
+		uint child[4];						// interior: QuadNode index; leaf: first entry in primIdx
+		uint count[4];						// primitives in a leaf child; 0 otherwise
+	};
+	BVH() = default;
+	BVH( const BVH& ) = delete; // owns its buffers
+	BVH& operator=( const BVH& ) = delete;
+	~BVH();
+	void Build( const aabb* primBounds, const uint primCount );
+	void Build( const float3* triVerts, const uint triCount ); // three vertices per triangle
+	void Refit( const aabb* primBounds );
+	void BuildQuad();
+	// queries on the binary tree
+	template <class F> void PointQuery( const float3& p, F&& visit ) const { OverlapQuery( aabb( p, p ), visit ); }
+	template <class F> void OverlapQuery( const aabb& box, F&& visit ) const;
+	// queries on the 4-wide tree; call BuildQuad first
+	template <class F> void QuadPointQuery( const float3& p, F&& visit ) const { QuadOverlapQuery( aabb( p, p ), visit ); }
+	template <class F> void QuadOverlapQuery( const aabb& box, F&& visit ) const;
+	// data members
+	uint* primIdx = 0;
+	Node* nodes = 0;
+	QuadNode* quadNodes = 0;
+	uint primCount = 0, nodesUsed = 0, quadNodesUsed = 0;
+	uint primCapacity = 0;	// primitives the buffers have room for; Build grows them as needed
+private:
+	void UpdateNodeBounds( const uint nodeIdx, const aabb* primBounds );
+	void Subdivide( const uint nodeIdx, const aabb* primBounds, const float3* centroids );
+	float FindBestSplitPlane( const Node& node, const aabb* primBounds, const float3* centroids, int& axis, float& splitPos ) const;
+	uint CollapseNode( const uint nodeIdx );
+	static bool Overlaps( const Node& n, const aabb& b )
+	{
+		return n.bmin.x <= b.bmax[0] && n.bmax.x >= b.bmin[0] && n.bmin.y <= b.bmax[1] &&
+			n.bmax.y >= b.bmin[1] && n.bmin.z <= b.bmax[2] && n.bmax.z >= b.bmin[2];
+	}
+};
+
+template <class F> void BVH::OverlapQuery( const aabb& box, F&& visit ) const
+{
+	if (!nodesUsed || !Overlaps( nodes[0], box )) return;
+	const Node* node = &nodes[0], *stack[64];
+	uint stackPtr = 0;
+	while (1)
+	{
+		if (node->IsLeaf())
+		{
+			for (uint i = 0; i < node->count; i++) visit( primIdx[node->leftFirst + i] );
+			if (stackPtr == 0) break; else node = stack[--stackPtr];
+			continue;
+		}
+		const Node* child1 = &nodes[node->leftFirst], *child2 = child1 + 1;
+		const bool hit1 = Overlaps( *child1, box ), hit2 = Overlaps( *child2, box );
+		if (hit1) { node = child1; if (hit2) stack[stackPtr++] = child2; }
+		else if (hit2) node = child2;
+		else if (stackPtr == 0) break; else node = stack[--stackPtr];
+	}
+}
+
+template <class F> void BVH::QuadOverlapQuery( const aabb& box, F&& visit ) const
+{
+	if (!quadNodesUsed) return;
+	const __m128 qminx = _mm_set1_ps( box.bmin[0] ), qminy = _mm_set1_ps( box.bmin[1] ), qminz = _mm_set1_ps( box.bmin[2] );
+	const __m128 qmaxx = _mm_set1_ps( box.bmax[0] ), qmaxy = _mm_set1_ps( box.bmax[1] ), qmaxz = _mm_set1_ps( box.bmax[2] );
+	uint stack[64 * 3], stackPtr = 0, nodeIdx = 0;
+	while (1)
+	{
+		const QuadNode& node = quadNodes[nodeIdx];
+		const __m128 hx = _mm_and_ps( _mm_cmple_ps( _mm_load_ps( node.bminx ), qmaxx ), _mm_cmpge_ps( _mm_load_ps( node.bmaxx ), qminx ) );
+		const __m128 hy = _mm_and_ps( _mm_cmple_ps( _mm_load_ps( node.bminy ), qmaxy ), _mm_cmpge_ps( _mm_load_ps( node.bmaxy ), qminy ) );
+		const __m128 hz = _mm_and_ps( _mm_cmple_ps( _mm_load_ps( node.bminz ), qmaxz ), _mm_cmpge_ps( _mm_load_ps( node.bmaxz ), qminz ) );
+		const int hits = _mm_movemask_ps( _mm_and_ps( _mm_and_ps( hx, hy ), hz ) );
+		for (int i = 0; i < 4; i++) if (hits & (1 << i))
+		{
+			if (node.count[i]) for (uint j = 0; j < node.count[i]; j++) visit( primIdx[node.child[i] + j] );
+			else stack[stackPtr++] = node.child[i];
+		}
+		if (stackPtr == 0) break;
+		nodeIdx = stack[--stackPtr];
+	}
+}
+
+} // namespace Tmpl8
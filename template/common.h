@@ -10,6 +10,11 @@
 #define SCRHEIGHT	720
 // #define FULLSCREEN
 
+// job system benchmark and fast math check results; the Benchmark build
+// configuration defines JOBBENCHMARK and runs both instead of the application
+#define JOBBENCHMARKFILE "jobbench.json"
+#define FASTMATHCHECKFILE "fastmath.json"
+
 // constants
 #define PI			3.14159265358979323846264f
 #define INVPI		0.31830988618379067153777f
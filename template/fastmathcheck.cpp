@@ -0,0 +1,98 @@
+// Template, IGAD version 3
+// Get the latest version from: https://github.com/jbikker/tmpl8
+// IGAD/NHTV/UU - Jacco Bikker - 2006-2023
+
+#include "precomp.h"
+
+// fast math error check
+// Run by the Benchmark configuration, next to the job system benchmarks.
+// Sweeps fast_rsqrt, fast_rcp and fast_sqrt at each FastMath precision over
+// 1e-6 .. 1e6, the range the bounds in tmpl8math.h are documented for, and
+// compares them against double precision. Every float in [1, 4) is visited
+// (the estimates repeat every one or two binades), plus every 61st float over
+// the full range. The float, floatx8 and floatx16 versions are all checked. A
+// bound that does not hold is a fatal error; the measured maxima go to a JSON file.
+// fast_length is fast_sqrt of a dot product and shares its bound.
+#define CHECKBATCH 4096
+
+static const char* functionName[3] = { "rsqrt", "rcp", "sqrt" };
+static const char* widthName[3] = { "float", "floatx8", "floatx16" };
+
+template <int P> static void Evaluate( const float* x, float* out[3][3] )
+{
+	for (int i = 0; i < CHECKBATCH; i++)
+		out[0][0][i] = fast_rsqrt<P>( x[i] ), out[1][0][i] = fast_rcp<P>( x[i] ), out[2][0][i] = fast_sqrt<P>( x[i] );
+	for (int i = 0; i < CHECKBATCH; i += 8)
+	{
+		const floatx8 v = floatx8::Load( x + i );
+		fast_rsqrt<P>( v ).Store( out[0][1] + i ), fast_rcp<P>( v ).Store( out[1][1] + i ), fast_sqrt<P>( v ).Store( out[2][1] + i );
+	}
+	for (int i = 0; i < CHECKBATCH; i += 16)
+	{
+		const floatx16 v = floatx16::Load( x + i );
+		fast_rsqrt<P>( v ).Store( out[0][2] + i ), fast_rcp<P>( v ).Store( out[1][2] + i ), fast_sqrt<P>( v ).Store( out[2][2] + i );
+	}
+}
+
+template <int P> static void Sweep( double maxError[3][3] )
+{
+	float* x = (float*)MALLOC64( CHECKBATCH * sizeof( float ) ), *out[3][3];
+	for (int f = 0; f < 3; f++) for (int w = 0; w < 3; w++) out[f][w] = (float*)MALLOC64( CHECKBATCH * sizeof( float ) ), maxError[f][w] = 0;
+	int n = 0;
+	auto flush = [&]() {
+		for (int i = n; i < CHECKBATCH; i++) x[i] = 1; // pad the last batch
+		Evaluate<P>( x, out );
+		for (int i = 0; i < CHECKBATCH; i++)
+		{
+			const double d = x[i], exact[3] = { 1 / sqrt( d ), 1 / d, sqrt( d ) };
+			for (int f = 0; f < 3; f++) for (int w = 0; w < 3; w++)
+				maxError[f][w] = max( maxError[f][w], fabs( out[f][w][i] - exact[f] ) / exact[f] );
+		}
+		n = 0;
+	};
+	auto visit = [&]( const uint bits ) {
+		memcpy( x + n, &bits, sizeof( float ) );
+		if (++n == CHECKBATCH) flush();
+	};
+	uint first, last, one, four;
+	const float lo = 1e-6f, hi = 1e6f, a = 1, b = 4;
+	memcpy( &first, &lo, 4 ), memcpy( &last, &hi, 4 ), memcpy( &one, &a, 4 ), memcpy( &four, &b, 4 );
+	for (uint bits = one; bits < four; bits++) visit( bits );
+	for (uint bits = first; bits <= last; bits += 61) visit( bits );
+	flush();
+	FREE64( x );
+	for (int f = 0; f < 3; f++) for (int w = 0; w < 3; w++) FREE64( out[f][w] );
+}
+
+void CheckFastMath( const char* jsonFile )
+{
+	// documented bounds for rsqrt, rcp and sqrt; PRECISE is exact up to float rounding
+	struct { const char* name; float bound[3]; } level[3] = {
+		{ "precise", { 1.2e-7f, 6e-8f, 6e-8f } },
+		{ "refined", { 3e-7f, 2e-7f, 3e-7f } },
+		{ "approx", { 3.7e-4f, 3.7e-4f, 3.7e-4f } }
+	};
+	double maxError[3][3][3];
+	Sweep<FastMath::PRECISE>( maxError[0] );
+	Sweep<FastMath::REFINED>( maxError[1] );
+	Sweep<FastMath::APPROX>( maxError[2] );
+	FILE* f = fopen( jsonFile, "w" );
+	FATALERROR_IF( !f, "Could not open %s for writing.", jsonFile );
+	fprintf( f, "{\n" );
+	for (int p = 0; p < 3; p++)
+	{
+		fprintf( f, "\t\"%s\": {\n", level[p].name );
+		for (int fn = 0; fn < 3; fn++)
+		{
+			fprintf( f, "\t\t\"%s\": { \"bound\": %.3g", functionName[fn], level[p].bound[fn] );
+			for (int w = 0; w < 3; w++) fprintf( f, ", \"%s\": %.3g", widthName[w], maxError[p][fn][w] );
+			fprintf( f, " }%s\n", fn == 2 ? "" : "," );
+		}
+		fprintf( f, "\t}%s\n", p == 2 ? "" : "," );
+	}
+	fprintf( f, "}\n" );
+	fclose( f );
+	for (int p = 0; p < 3; p++) for (int fn = 0; fn < 3; fn++) for (int w = 0; w < 3; w++)
+		FATALERROR_IF( maxError[p][fn][w] > level[p].bound[fn], "fast_%s<FastMath::%s> on %s: relative error %.3g exceeds the documented %.3g.",
+			functionName[fn], level[p].name, widthName[w], maxError[p][fn][w], level[p].bound[fn] );
+}
@@ -0,0 +1,117 @@
+// Template, IGAD version 3
+// Get the latest version from: https://github.com/jbikker/tmpl8
+// IGAD/NHTV/UU - Jacco Bikker - 2006-2023
+
+#include "precomp.h"
+
+// job system microbenchmarks
+// Built by the Benchmark configuration, which defines JOBBENCHMARK: the executable
+// (myGame_bench) then runs these instead of the application.
+// All timings are in microseconds unless stated otherwise. Note that there is
+// no work stealing: all workers share one queue, and the thread that calls
+// RunJobs helps out. The 'distribution' section shows how jobs spread over the
+// workers, and how many were picked up by the calling thread.
+
+static void WriteDistribution( FILE* f, JobManager* jm, const char* name, const bool last )
+{
+	const uint threads = jm->GetNumThreads();
+	size_t total = 0;
+	for (uint i = 0; i <= threads; i++) total += jm->GetContext( i ).jobsExecuted;
+	fprintf( f, "\t\"%s\": { \"jobs\": %zu, \"mainThreadShare\": %.4f, \"workerShare\": [", name, total,
+		total ? jm->GetContext( threads ).jobsExecuted / (double)total : 0 );
+	for (uint i = 0; i < threads; i++)
+		fprintf( f, "%s%.4f", i ? ", " : "", total ? jm->GetContext( i ).jobsExecuted / (double)total : 0 );
+	fprintf( f, "] }%s\n", last ? "" : "," );
+}
+
+void RunJobBenchmarks( const char* jsonFile )
+{
+	JobManager* jm = JobManager::GetJobManager();
+	const uint threads = jm->GetNumThreads();
+	FILE* f = fopen( jsonFile, "w" );
+	FATALERROR_IF( !f, "Could not open %s for writing.", jsonFile );
+	fprintf( f, "{\n\t\"threads\": %u,\n", threads );
+	// warm up: wake every worker once
+	for (int i = 0; i < 100; i++) { for (uint j = 0; j <= threads; j++) jm->AddJob( [] {} ); jm->RunJobs(); }
+
+	// empty-job throughput: batches of trivial jobs, measured end to end
+	{
+		const int batches = 2000, perBatch = 200;
+		jm->ResetStats();
+		Timer timer;
+		for (int i = 0; i < batches; i++)
+		{
+			for (int j = 0; j < perBatch; j++) jm->AddJob( [] {} );
+			jm->RunJobs();
+		}
+		const double seconds = timer.elapsed(), jobs = (double)batches * perBatch;
+		fprintf( f, "\t\"emptyJobs\": { \"jobs\": %.0f, \"seconds\": %.6f, \"jobsPerSecond\": %.0f, \"nsPerJob\": %.2f },\n",
+			jobs, seconds, jobs / seconds, seconds * 1e9 / jobs );
+		WriteDistribution( f, jm, "emptyJobDistribution", false );
+	}
+
+	// fork/join latency against the number of active workers: fork one small job
+	// per participating thread (the active workers plus the caller), join in RunJobs
+	{
+		fprintf( f, "\t\"forkJoin\": [\n" );
+		const int reps = 5000;
+		for (uint workers = 1; workers <= threads; workers++)
+		{
+			jm->SetActiveWorkers( workers );
+			double total = 0, best = 1e9;
+			for (int i = 0; i < reps; i++)
+			{
+				Timer timer;
+				for (uint j = 0; j <= workers; j++) jm->AddJob( []( JobContext& context ) { context.counter[0]++; } );
+				jm->RunJobs();
+				const double us = timer.elapsed() * 1e6;
+				total += us, best = min( best, us );
+			}
+			fprintf( f, "\t\t{ \"workers\": %u, \"jobs\": %u, \"avgUs\": %.3f, \"minUs\": %.3f }%s\n", workers, workers + 1, total / reps, best, workers == threads ? "" : "," );
+		}
+		jm->SetActiveWorkers( threads );
+		fprintf( f, "\t],\n" );
+	}
+
+	// uneven jobs: shows how work spreads when some jobs are expensive
+	{
+		jm->ResetStats();
+		for (int i = 0; i < 200; i++)
+		{
+			for (int j = 0; j < 64; j++) jm->AddJob( [j]( JobContext& context ) {
+				float v = context.RandomFloat();
+				for (int k = 0; k < (j & 7) * 500; k++) v = v * 0.999f + 0.001f;
+				context.counter[1] += v > 2; // keep the loop alive
+			} );
+			jm->RunJobs();
+		}
+		WriteDistribution( f, jm, "unevenJobDistribution", false );
+	}
+
+	// ParallelFor overhead against a serial loop, at various grain sizes
+	{
+		const int N = 1 << 22, reps = 20;
+		float* data = (float*)MALLOC64( N * sizeof( float ) );
+		for (int i = 0; i < N; i++) data[i] = (float)i;
+		Timer timer;
+		for (int r = 0; r < reps; r++) for (int i = 0; i < N; i++) data[i] = data[i] * 0.999f + 0.001f;
+		const double serialUs = timer.elapsed() * 1e6 / reps;
+		fprintf( f, "\t\"parallelFor\": { \"items\": %d, \"serialUs\": %.2f, \"grains\": [\n", N, serialUs );
+		const int grains[] = { 64, 256, 1024, 4096, 16384, 65536, 262144, 1048576 };
+		for (int g = 0; g < 8; g++)
+		{
+			const int grain = grains[g];
+			timer.reset();
+			for (int r = 0; r < reps; r++) jm->ParallelFor( 0, N, grain, [data]( int start, int end, JobContext& ) {
+				for (int i = start; i < end; i++) data[i] = data[i] * 0.999f + 0.001f;
+			} );
+			const double us = timer.elapsed() * 1e6 / reps, chunks = (N + grain - 1) / grain;
+			fprintf( f, "\t\t{ \"grain\": %d, \"chunks\": %.0f, \"us\": %.2f, \"speedup\": %.3f, \"nsPerChunk\": %.2f }%s\n",
+				grain, chunks, us, serialUs / us, us * 1000 / chunks, g == 7 ? "" : "," );
+		}
+		fprintf( f, "\t] }\n" );
+		FREE64( data );
+	}
+	fprintf( f, "}\n" );
+	fclose( f );
+}
@@ -12,6 +12,9 @@
 #include <math.h>
 #include <algorithm>
 #include <assert.h>
+#include <atomic>
+#include <new>
+#include <type_traits>
 #include <io.h>
 
 // header for AVX, and every technology before it.
@@ -58,6 +61,7 @@ using namespace std;
 // template headers
 #include "surface.h"
 #include "sprite.h"
+#include "bvh.h"
 
 // namespaces
 using namespace Tmpl8;
@@ -150,13 +154,101 @@ struct Timer
 };
 
 // Nils's jobmanager
+class JobContext;
 class Job
 {
 public:
-	virtual void Main() = 0;
+	virtual void Main( JobContext& a_Context ) = 0;
 protected:
 	friend class JobThread;
-	void RunCodeWrapper();
+	friend class JobManager;
+	void RunCodeWrapper( JobContext& a_Context );
+	class JobCounter* m_Signal = 0;	// decremented when this job completes
+	Job* m_NextWaiting = 0;			// link in the wait list of a JobCounter
+};
+// completion counter for expressing dependencies between frame jobs. Jobs added
+// with the counter as 'signal' increment it and decrement it when they finish;
+// jobs added with the counter as 'waitFor' stay parked (they do not occupy a
+// worker) until it drops to zero. JobManager::WaitFor lets a running job or the
+// main thread execute other jobs until a counter is done.
+class JobCounter
+{
+public:
+	bool Done() const { return m_Count.load() == 0; }
+protected:
+	friend class JobManager;
+	atomic<int> m_Count = 0;
+	Job* m_Waiting = 0;
+};
+// per-frame bump allocator for jobs and their closures. Memory is reserved once;
+// Alloc is lock-free so jobs may spawn jobs. Reset runs registered destructors.
+class JobArena
+{
+public:
+	void Init( size_t a_Size );
+	void* Alloc( size_t a_Size, size_t a_Align = 16 );
+	template <class T, class... A> T* New( A&&... a_Args )
+	{
+		T* object = new (Alloc( sizeof( T ), alignof( T ) )) T( forward<A>( a_Args )... );
+		if constexpr (!is_trivially_destructible<T>::value) AddDestructor( object, []( void* p ) { ((T*)p)->~T(); } );
+		return object;
+	}
+	void Reset();
+	void Rewind( size_t a_Mark ) { m_Used = a_Mark; } // raw allocations only; skips destructors
+	size_t Used() const { return min( m_Used.load(), m_Size ); }
+	size_t Capacity() const { return m_Size; }
+protected:
+	struct Destructor { void (*func)(void*); void* object; Destructor* next; };
+	void AddDestructor( void* a_Object, void (*a_Func)(void*) );
+	uchar* m_Base = 0;
+	size_t m_Size = 0;
+	atomic<size_t> m_Used = 0;
+	atomic<Destructor*> m_Destructors = 0;
+};
+// per-worker state handed to every job: worker index, a private xorshift
+// stream, scratch memory that lives for the duration of one job, and counters.
+// Contexts are cache line aligned so workers never share a line.
+class ALIGN( 64 ) JobContext
+{
+public:
+	void Init( uint a_ThreadIdx, size_t a_ScratchSize );
+	uint RandomUInt() { return ::RandomUInt( seed ); }
+	float RandomFloat() { return ::RandomFloat( seed ); }
+	float Rand( const float range ) { return ::RandomFloat( seed ) * range; }
+	void* ScratchAlloc( size_t a_Size, size_t a_Align = 16 ) { return scratch.Alloc( a_Size, a_Align ); }
+	template <class T> T* ScratchAlloc( size_t a_Count ) { return (T*)scratch.Alloc( a_Count * sizeof( T ), alignof( T ) ); }
+	void ResetStats() { jobsExecuted = 0, busyTime = 0; memset( counter, 0, sizeof( counter ) ); }
+	// data members
+	uint threadIdx = 0;			// worker index, 0 .. JobManager::GetNumThreads() - 1
+	uint seed = 0;				// RNG state, seeded with InitSeed( threadIdx )
+	JobArena scratch;			// bump allocator; rewound after every job
+	size_t jobsExecuted = 0;	// stats: number of jobs run by this worker
+	float busyTime = 0;			// stats: seconds spent executing jobs
+	size_t counter[8] = {};		// free-form per-worker counters; see JobManager::SumCounter
+};
+// job wrapping a callable; closures up to 48 bytes are stored inside the job,
+// larger ones go to the arena the job itself was allocated from. The callable
+// may take a JobContext& or no arguments.
+class ClosureJob : public Job
+{
+public:
+	template <class F> ClosureJob( F&& a_Func, JobArena& a_Arena )
+	{
+		typedef typename decay<F>::type T;
+		void* mem = (sizeof( T ) <= sizeof( m_Inline ) && alignof( T ) <= 16) ? m_Inline : a_Arena.Alloc( sizeof( T ), alignof( T ) );
+		m_Closure = new (mem) T( forward<F>( a_Func ) );
+		m_Invoke = []( void* c, JobContext& context ) {
+			if constexpr (is_invocable<T&, JobContext&>::value) (*(T*)c)( context ); else (*(T*)c)();
+		};
+		m_Destroy = []( void* c ) { ((T*)c)->~T(); };
+	}
+	~ClosureJob() { m_Destroy( m_Closure ); }
+	void Main( JobContext& a_Context ) { m_Invoke( m_Closure, a_Context ); }
+protected:
+	ALIGN( 16 ) uchar m_Inline[48];
+	void* m_Closure;
+	void (*m_Invoke)(void*, JobContext&);
+	void (*m_Destroy)(void*);
 };
 class JobThread
 {
@@ -166,6 +258,7 @@ public:
 	void BackgroundTask();
 	HANDLE m_GoSignal, m_ThreadHandle;
 	int m_ThreadID;
+	JobContext m_Context;
 };
 class JobManager	// singleton class!
 {
@@ -176,22 +269,74 @@ public:
 	static void CreateJobManager( unsigned int numThreads );
 	static JobManager* GetJobManager();
 	static void GetProcessorCount( uint& cores, uint& logical );
-	void AddJob2( Job* a_Job );
+	// frame jobs: always picked before background work; RunJobs waits for all of them
+	void AddJob2( Job* a_Job, JobCounter* a_Signal = 0, JobCounter* a_WaitFor = 0 );
+	// frame jobs allocated from the frame arena, released after RunJobs
+	template <class T, class... A> T* NewJob( A&&... a_Args ) { T* job = m_FrameArena.New<T>( forward<A>( a_Args )... ); AddJob2( job ); return job; }
+	template <class F> void AddJob( F&& a_Func, JobCounter* a_Signal = 0, JobCounter* a_WaitFor = 0 )
+	{
+		AddJob2( m_FrameArena.New<ClosureJob>( forward<F>( a_Func ), m_FrameArena ), a_Signal, a_WaitFor );
+	}
+	// run other frame jobs on the calling thread until the counter reaches zero;
+	// when there are none, the thread yields WAITSPINS times and then sleeps
+	void WaitFor( JobCounter& a_Counter, JobContext& a_Context );
+	// process [first, last) in chunks of 'grain' items: func( start, end, context ).
+	// Chunks are handed out dynamically to one job per thread. Call from the main
+	// thread only: this runs RunJobs, so other queued frame jobs are flushed too.
+	template <class F> void ParallelFor( const int a_First, const int a_Last, const int a_Grain, F&& a_Func )
+	{
+		const int chunks = (a_Last - a_First + a_Grain - 1) / a_Grain;
+		if (chunks <= 1) { if (a_Last > a_First) a_Func( a_First, a_Last, m_MainContext ); return; }
+		atomic<int> next = a_First;
+		const int jobs = min( chunks, (int)m_NumThreads + 1 );
+		for (int i = 0; i < jobs; i++) AddJob( [&]( JobContext& context ) {
+			for (int start; (start = next.fetch_add( a_Grain )) < a_Last;) a_Func( start, min( start + a_Grain, a_Last ), context );
+		} );
+		RunJobs();
+	}
+	void* FrameAlloc( size_t a_Size, size_t a_Align = 16 ) { return m_FrameArena.Alloc( a_Size, a_Align ); }
+	JobArena& GetFrameArena() { return m_FrameArena; }
+	// background jobs: caller-owned, run on idle workers (at most GetNumThreads() - 1
+	// at a time) and may span several frames; RunJobs never waits for them.
+	void AddBackgroundJob( Job* a_Job );
+	size_t BackgroundJobsPending();
 	unsigned int GetNumThreads() { return m_NumThreads; }
 	void RunJobs();
-	void ThreadDone( unsigned int n );
 	int MaxConcurrent() { return m_NumThreads; }
+	// limit frame and background work to workers 0 .. count - 1 (at least one), e.g. to
+	// measure scaling; the thread calling RunJobs still helps out
+	void SetActiveWorkers( const unsigned int a_Count );
+	unsigned int GetActiveWorkers() { return m_ActiveWorkers; }
+	// contexts 0 .. GetNumThreads() - 1 belong to the workers; context GetNumThreads()
+	// is used by the thread calling RunJobs, which helps executing frame jobs.
+	JobContext& GetContext( unsigned int a_ThreadIdx ) { return a_ThreadIdx < m_NumThreads ? m_JobThreadList[a_ThreadIdx].m_Context : m_MainContext; }
+	size_t SumCounter( const int a_Idx );
+	void ResetStats();
 protected:
 	friend class JobThread;
-	Job* GetNextJob();
+	Job* GetNextJob( bool& a_FrameJob, const bool a_AllowBackground );
+	void FrameJobDone( Job* a_Job );
 	static JobManager* m_JobManager;
 	Job* m_JobList[256];
+	Job* m_BackgroundList[256];
 	CRITICAL_SECTION m_CS;
-	HANDLE m_ThreadDone[64];
-	unsigned int m_NumThreads, m_JobCount;
+	CONDITION_VARIABLE m_WorkAvailable;	// signalled when frame jobs are queued or a counter completes
+	HANDLE m_FrameDone;
+	unsigned int m_NumThreads, m_JobCount, m_MaxBackground;
+	unsigned int m_BackgroundHead, m_BackgroundTail;
+	atomic<int> m_FramePending;
+	atomic<unsigned int> m_BackgroundRunning;
+	atomic<unsigned int> m_ActiveWorkers;
 	JobThread* m_JobThreadList;
+	JobArena m_FrameArena;
+	JobContext m_MainContext;
 };
 
+// job system benchmarks; run by the Benchmark build configuration, see jobbench.cpp
+void RunJobBenchmarks( const char* jsonFile );
+// sweeps the FastMath functions against their documented error bounds; see fastmathcheck.cpp
+void CheckFastMath( const char* jsonFile );
+
 // forward declaration of helper functions
 void FatalError( const char* fmt, ... );
 bool FileIsNewer( const char* file1, const char* file2 );
@@ -86,6 +86,11 @@ void ErrorCallback( int, const char* description )
 // Application entry point
 void main()
 {
+#ifdef JOBBENCHMARK
+	// headless run: measure the job system and exit
+	RunJobBenchmarks( JOBBENCHMARKFILE );
+	CheckFastMath( FASTMATHCHECKFILE );
+#else
 	// open a window
 	if (!glfwInit()) FatalError( "glfwInit failed." );
 	glfwSetErrorCallback( ErrorCallback );
@@ -355,9 +360,11 @@ void main()
 	Kernel::KillCL();
 	glfwDestroyWindow( window );
 	glfwTerminate();
+#endif
 }
 
 // Jobmanager implementation
+#define WAITSPINS 64 // empty polls before JobManager::WaitFor parks the thread
 DWORD JobThreadProc( LPVOID lpParameter )
 {
 	JobThread* JobThreadInstance = (JobThread*)lpParameter;
@@ -367,25 +374,27 @@ DWORD JobThreadProc( LPVOID lpParameter )
 
 void JobThread::CreateAndStartThread( unsigned int threadId )
 {
+	// prepare the worker context before the thread can touch it
+	m_ThreadID = threadId;
+	m_Context.Init( threadId, 256 * 1024 );
 	m_GoSignal = CreateEvent( 0, FALSE, FALSE, 0 );
 	m_ThreadHandle = CreateThread( 0, 0, (LPTHREAD_START_ROUTINE)&JobThreadProc, (LPVOID)this, 0, 0 );
-	m_ThreadID = threadId;
 }
 void JobThread::BackgroundTask()
 {
+	JobManager* jm = JobManager::GetJobManager();
 	while (1)
 	{
 		WaitForSingleObject( m_GoSignal, INFINITE );
-		while (1)
+		Timer timer;
+		bool isFrameJob;
+		// workers beyond the active count go back to sleep; see SetActiveWorkers
+		while (Job* job = (uint)m_ThreadID < jm->m_ActiveWorkers ? jm->GetNextJob( isFrameJob, true ) : 0)
 		{
-			Job* job = JobManager::GetJobManager()->GetNextJob();
-			if (!job)
-			{
-				JobManager::GetJobManager()->ThreadDone( m_ThreadID );
-				break;
-			}
-			job->RunCodeWrapper();
+			job->RunCodeWrapper( m_Context );
+			if (isFrameJob) jm->FrameJobDone( job ); else jm->m_BackgroundRunning--;
 		}
+		m_Context.busyTime += timer.elapsed();
 	}
 }
 
@@ -394,9 +403,49 @@ void JobThread::Go()
 	SetEvent( m_GoSignal );
 }
 
-void Job::RunCodeWrapper()
+void Job::RunCodeWrapper( JobContext& a_Context )
+{
+	// jobs may nest through JobManager::WaitFor, so rewind rather than reset
+	const size_t scratchMark = a_Context.scratch.Used();
+	Main( a_Context );
+	a_Context.jobsExecuted++;
+	a_Context.scratch.Rewind( scratchMark );
+}
+
+void JobContext::Init( uint a_ThreadIdx, size_t a_ScratchSize )
 {
-	Main();
+	threadIdx = a_ThreadIdx;
+	seed = InitSeed( a_ThreadIdx );
+	scratch.Init( a_ScratchSize );
+	ResetStats();
+}
+
+void JobArena::Init( size_t a_Size )
+{
+	m_Base = (uchar*)MALLOC64( a_Size );
+	m_Size = a_Size;
+	m_Used = 0;
+}
+
+void* JobArena::Alloc( size_t a_Size, size_t a_Align )
+{
+	const size_t offset = m_Used.fetch_add( a_Size + a_Align - 1 );
+	FATALERROR_IF( offset + a_Size + a_Align - 1 > m_Size, "Job arena exhausted (%zu bytes); increase its size in CreateJobManager.", m_Size );
+	const size_t aligned = ((size_t)(m_Base + offset) + a_Align - 1) & ~(a_Align - 1);
+	return (void*)aligned;
+}
+
+void JobArena::AddDestructor( void* a_Object, void (*a_Func)(void*) )
+{
+	Destructor* d = (Destructor*)Alloc( sizeof( Destructor ), alignof( Destructor ) );
+	d->func = a_Func, d->object = a_Object, d->next = m_Destructors.load();
+	while (!m_Destructors.compare_exchange_weak( d->next, d ));
+}
+
+void JobArena::Reset()
+{
+	for (Destructor* d = m_Destructors.exchange( 0 ); d; d = d->next) d->func( d->object );
+	m_Used = 0;
 }
 
 JobManager* JobManager::m_JobManager = 0;
@@ -404,6 +453,14 @@ JobManager* JobManager::m_JobManager = 0;
 JobManager::JobManager( unsigned int threads ) : m_NumThreads( threads )
 {
 	InitializeCriticalSection( &m_CS );
+	InitializeConditionVariable( &m_WorkAvailable );
+	m_FrameDone = CreateEvent( 0, FALSE, FALSE, 0 );
+	m_JobCount = m_BackgroundHead = m_BackgroundTail = 0;
+	m_FramePending = 1; // guard; released by RunJobs
+	m_BackgroundRunning = 0;
+	m_ActiveWorkers = threads;
+	// leave one worker for frame jobs, unless there is only one
+	m_MaxBackground = max( 1u, threads - 1 );
 }
 
 JobManager::~JobManager()
@@ -414,39 +471,159 @@ JobManager::~JobManager()
 void JobManager::CreateJobManager( unsigned int numThreads )
 {
 	m_JobManager = new JobManager( numThreads );
+	m_JobManager->m_FrameArena.Init( 4 * 1024 * 1024 );
+	m_JobManager->m_MainContext.Init( numThreads, 256 * 1024 );
 	m_JobManager->m_JobThreadList = new JobThread[numThreads];
-	for (unsigned int i = 0; i < numThreads; i++)
+	for (unsigned int i = 0; i < numThreads; i++) m_JobManager->m_JobThreadList[i].CreateAndStartThread( i );
+}
+
+void JobManager::AddJob2( Job* a_Job, JobCounter* a_Signal, JobCounter* a_WaitFor )
+{
+	a_Job->m_Signal = a_Signal;
+	EnterCriticalSection( &m_CS );
+	if (a_Signal) a_Signal->m_Count++;
+	m_FramePending++;
+	if (a_WaitFor && !a_WaitFor->Done())
 	{
-		m_JobManager->m_JobThreadList[i].CreateAndStartThread( i );
-		m_JobManager->m_ThreadDone[i] = CreateEvent( 0, FALSE, FALSE, 0 );
+		// park the job; it is queued when the counter drops to zero
+		a_Job->m_NextWaiting = a_WaitFor->m_Waiting;
+		a_WaitFor->m_Waiting = a_Job;
 	}
-	m_JobManager->m_JobCount = 0;
+	else
+	{
+		FATALERROR_IF( m_JobCount == 256, "Too many frame jobs; call RunJobs more often." );
+		m_JobList[m_JobCount++] = a_Job;
+		WakeAllConditionVariable( &m_WorkAvailable );
+	}
+	LeaveCriticalSection( &m_CS );
 }
 
-void JobManager::AddJob2( Job* a_Job )
+void JobManager::AddBackgroundJob( Job* a_Job )
 {
-	m_JobList[m_JobCount++] = a_Job;
+	EnterCriticalSection( &m_CS );
+	FATALERROR_IF( m_BackgroundTail - m_BackgroundHead == 256, "Background job queue is full." );
+	m_BackgroundList[m_BackgroundTail++ & 255] = a_Job;
+	LeaveCriticalSection( &m_CS );
+	// wake idle workers; busy ones will find the job when they run dry
+	for (unsigned int i = 0; i < m_ActiveWorkers; i++) m_JobThreadList[i].Go();
 }
 
-Job* JobManager::GetNextJob()
+Job* JobManager::GetNextJob( bool& a_FrameJob, const bool a_AllowBackground )
 {
+	// frame jobs always go first; background jobs only run on spare workers
 	Job* job = 0;
 	EnterCriticalSection( &m_CS );
-	if (m_JobCount > 0) job = m_JobList[--m_JobCount];
+	if (m_JobCount > 0) job = m_JobList[--m_JobCount], a_FrameJob = true;
+	else if (a_AllowBackground && m_BackgroundHead != m_BackgroundTail && m_BackgroundRunning < m_MaxBackground)
+	{
+		job = m_BackgroundList[m_BackgroundHead++ & 255], a_FrameJob = false;
+		m_BackgroundRunning++;
+	}
 	LeaveCriticalSection( &m_CS );
 	return job;
 }
 
+void JobManager::FrameJobDone( Job* a_Job )
+{
+	JobCounter* signal = a_Job->m_Signal;
+	if (signal)
+	{
+		// the counter may live on the stack of a thread that polls Done(): take the
+		// wait list first and decrement last, so the counter is not touched after
+		// it reads as done. Both happen under m_CS, as do increments in AddJob2.
+		EnterCriticalSection( &m_CS );
+		const bool last = signal->m_Count == 1;
+		if (last)
+		{
+			// release the jobs that were waiting for this counter
+			for (Job* waiting = signal->m_Waiting; waiting; waiting = waiting->m_NextWaiting)
+			{
+				FATALERROR_IF( m_JobCount == 256, "Too many frame jobs; call RunJobs more often." );
+				m_JobList[m_JobCount++] = waiting;
+			}
+			signal->m_Waiting = 0;
+			// wake threads parked in WaitFor, for the released jobs or for the counter itself
+			WakeAllConditionVariable( &m_WorkAvailable );
+		}
+		signal->m_Count--;
+		LeaveCriticalSection( &m_CS );
+		if (last) for (unsigned int i = 0; i < m_ActiveWorkers; i++) m_JobThreadList[i].Go();
+	}
+	if (--m_FramePending == 0) SetEvent( m_FrameDone );
+}
+
+void JobManager::WaitFor( JobCounter& a_Counter, JobContext& a_Context )
+{
+	// keep the calling thread busy with other frame work instead of blocking it;
+	// after WAITSPINS attempts without finding any, park it until a job is queued
+	// or the counter completes. Both are signalled under m_CS, so no wakeup is lost.
+	for (int idle = 0; !a_Counter.Done();)
+	{
+		bool isFrameJob;
+		if (Job* job = GetNextJob( isFrameJob, false ))
+		{
+			job->RunCodeWrapper( a_Context );
+			FrameJobDone( job );
+			idle = 0;
+		}
+		else if (++idle < WAITSPINS) SwitchToThread();
+		else
+		{
+			EnterCriticalSection( &m_CS );
+			while (!a_Counter.Done() && m_JobCount == 0) SleepConditionVariableCS( &m_WorkAvailable, &m_CS, INFINITE );
+			LeaveCriticalSection( &m_CS );
+			idle = 0;
+		}
+	}
+}
+
 void JobManager::RunJobs()
 {
-	if (m_JobCount == 0) return;
-	for (unsigned int i = 0; i < m_NumThreads; i++) m_JobThreadList[i].Go();
-	WaitForMultipleObjects( m_NumThreads, m_ThreadDone, TRUE, INFINITE );
+	if (m_JobCount > 0)
+	{
+		for (unsigned int i = 0; i < m_ActiveWorkers; i++) m_JobThreadList[i].Go();
+		// the calling thread helps out, so a worker that is stuck on a long
+		// background job can never hold up the frame.
+		bool isFrameJob;
+		while (Job* job = GetNextJob( isFrameJob, false ))
+		{
+			job->RunCodeWrapper( m_MainContext );
+			FrameJobDone( job );
+		}
+	}
+	// release the guard; wait only if workers are still running frame jobs
+	if (--m_FramePending > 0) WaitForSingleObject( m_FrameDone, INFINITE );
+	m_FramePending = 1;
+	// all frame jobs completed; recycle their memory
+	m_FrameArena.Reset();
+}
+
+void JobManager::SetActiveWorkers( const unsigned int a_Count )
+{
+	// call between frames; workers that are running finish their current job first
+	m_ActiveWorkers = max( 1u, min( a_Count, m_NumThreads ) );
+}
+
+size_t JobManager::BackgroundJobsPending()
+{
+	EnterCriticalSection( &m_CS );
+	const size_t pending = (m_BackgroundTail - m_BackgroundHead) + m_BackgroundRunning;
+	LeaveCriticalSection( &m_CS );
+	return pending;
+}
+
+size_t JobManager::SumCounter( const int a_Idx )
+{
+	// call between frames; workers update their counters without synchronization
+	size_t sum = m_MainContext.counter[a_Idx];
+	for (unsigned int i = 0; i < m_NumThreads; i++) sum += m_JobThreadList[i].m_Context.counter[a_Idx];
+	return sum;
 }
 
-void JobManager::ThreadDone( unsigned int n )
+void JobManager::ResetStats()
 {
-	SetEvent( m_ThreadDone[n] );
+	for (unsigned int i = 0; i < m_NumThreads; i++) m_JobThreadList[i].m_Context.ResetStats();
+	m_MainContext.ResetStats();
 }
 
 DWORD CountSetBits( ULONG_PTR bitMask )
@@ -61,9 +61,17 @@ static float SmoothedNoise( const int i, const int x, const int y )
 	const float center = Noise( i, x, y ) / 4;
 	return corners + sides + center;
 }
+// odd quintic fit of the original (1 - cos( pi * x )) / 2 weight; max deviation 9.3e-5,
+// exact at 0, 0.5 and 1, zero slope at the ends. Shared with the batch path below.
+static const float interpA = 3.1393551f, interpB = -5.1148405f, interpC = 2.2296809f;
+static inline float InterpolationWeight( const float x )
+{
+	const float t = x - 0.5f, t2 = t * t;
+	return 0.5f + 0.5f * (t * (interpA + t2 * (interpB + t2 * interpC)));
+}
 static float Interpolate( const float a, const float b, const float x )
 {
-	const float ft = x * 3.1415927f, f = (1 - cosf( ft )) * 0.5f;
+	const float f = InterpolationWeight( x );
 	return a * (1 - f) + b * f;
 }
 static float InterpolatedNoise( const int i, const float x, const float y )
@@ -192,4 +200,257 @@ float3 TransformVector_SSE( const __m128& a, const mat4& M )
 	_MM_TRANSPOSE4_PS( v0, v1, v2, v3 );
 	__m128 v = _mm_add_ps( _mm_add_ps( v0, v1 ), v2 );
 	return float3( v.m128_f32[0], v.m128_f32[1], v.m128_f32[2] );
-}
\ No newline at end of file
+}
+// batched transforms
+// The AVX2 paths load 8 points per iteration and transpose them to SoA registers;
+// since every lane is transformed independently, the lane order used by the
+// load and store transposes only needs to match. Remainders use scalar code.
+static inline bool UseAVX2() { return CPUCaps::HW_AVX2 && CPUCaps::HW_FMA3; }
+static inline __m256 Row8( const __m256* r, const __m256 x, const __m256 y, const __m256 z )
+{
+	return _mm256_fmadd_ps( x, r[0], _mm256_fmadd_ps( y, r[1], _mm256_fmadd_ps( z, r[2], r[3] ) ) );
+}
+static inline void Load8( const float* p, __m256& x, __m256& y, __m256& z )
+{
+	// 8 x float3 (24 floats) to SoA
+	__m256 m03 = _mm256_castps128_ps256( _mm_loadu_ps( p ) ), m14 = _mm256_castps128_ps256( _mm_loadu_ps( p + 4 ) );
+	__m256 m25 = _mm256_castps128_ps256( _mm_loadu_ps( p + 8 ) );
+	m03 = _mm256_insertf128_ps( m03, _mm_loadu_ps( p + 12 ), 1 );
+	m14 = _mm256_insertf128_ps( m14, _mm_loadu_ps( p + 16 ), 1 );
+	m25 = _mm256_insertf128_ps( m25, _mm_loadu_ps( p + 20 ), 1 );
+	const __m256 xy = _mm256_shuffle_ps( m14, m25, _MM_SHUFFLE( 2, 1, 3, 2 ) );
+	const __m256 yz = _mm256_shuffle_ps( m03, m14, _MM_SHUFFLE( 1, 0, 2, 1 ) );
+	x = _mm256_shuffle_ps( m03, xy, _MM_SHUFFLE( 2, 0, 3, 0 ) );
+	y = _mm256_shuffle_ps( yz, xy, _MM_SHUFFLE( 3, 1, 2, 0 ) );
+	z = _mm256_shuffle_ps( yz, m25, _MM_SHUFFLE( 3, 0, 3, 1 ) );
+}
+static inline void Store8( float* p, const __m256 x, const __m256 y, const __m256 z )
+{
+	// inverse of Load8
+	const __m256 rxy = _mm256_shuffle_ps( x, y, _MM_SHUFFLE( 2, 0, 2, 0 ) );
+	const __m256 ryz = _mm256_shuffle_ps( y, z, _MM_SHUFFLE( 3, 1, 3, 1 ) );
+	const __m256 rzx = _mm256_shuffle_ps( z, x, _MM_SHUFFLE( 3, 1, 2, 0 ) );
+	const __m256 r03 = _mm256_shuffle_ps( rxy, rzx, _MM_SHUFFLE( 2, 0, 2, 0 ) );
+	const __m256 r14 = _mm256_shuffle_ps( ryz, rxy, _MM_SHUFFLE( 3, 1, 2, 0 ) );
+	const __m256 r25 = _mm256_shuffle_ps( rzx, ryz, _MM_SHUFFLE( 3, 1, 3, 1 ) );
+	_mm_storeu_ps( p, _mm256_castps256_ps128( r03 ) ), _mm_storeu_ps( p + 4, _mm256_castps256_ps128( r14 ) );
+	_mm_storeu_ps( p + 8, _mm256_castps256_ps128( r25 ) ), _mm_storeu_ps( p + 12, _mm256_extractf128_ps( r03, 1 ) );
+	_mm_storeu_ps( p + 16, _mm256_extractf128_ps( r14, 1 ) ), _mm_storeu_ps( p + 20, _mm256_extractf128_ps( r25, 1 ) );
+}
+static inline void SetupRows8( __m256* r, const mat4& M, const float w, const int rows )
+{
+	// broadcast matrix rows; w scales the translation column (1 for points, 0 for vectors)
+	for (int i = 0; i < rows; i++)
+	{
+		r[i * 4 + 0] = _mm256_set1_ps( M.cell[i * 4 + 0] );
+		r[i * 4 + 1] = _mm256_set1_ps( M.cell[i * 4 + 1] );
+		r[i * 4 + 2] = _mm256_set1_ps( M.cell[i * 4 + 2] );
+		r[i * 4 + 3] = _mm256_set1_ps( M.cell[i * 4 + 3] * w );
+	}
+}
+static void TransformAoS( const float3* in, float3* out, const int count, const mat4& M, const float w )
+{
+	int i = 0;
+	if (UseAVX2())
+	{
+		__m256 r[12];
+		SetupRows8( r, M, w, 3 );
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256 x, y, z;
+			Load8( &in[i].x, x, y, z );
+			Store8( &out[i].x, Row8( r, x, y, z ), Row8( r + 4, x, y, z ), Row8( r + 8, x, y, z ) );
+		}
+	}
+	for (; i < count; i++) out[i] = make_float3( make_float4( in[i], w ) * M );
+}
+void TransformPositions( const float3* in, float3* out, const int count, const mat4& M ) { TransformAoS( in, out, count, M, 1 ); }
+void TransformVectors( const float3* in, float3* out, const int count, const mat4& M ) { TransformAoS( in, out, count, M, 0 ); }
+void TransformPositions( const float* x, const float* y, const float* z, float* ox, float* oy, float* oz, const int count, const mat4& M )
+{
+	int i = 0;
+	if (UseAVX2())
+	{
+		__m256 r[12];
+		SetupRows8( r, M, 1, 3 );
+		for (; i + 8 <= count; i += 8)
+		{
+			const __m256 x8 = _mm256_loadu_ps( x + i ), y8 = _mm256_loadu_ps( y + i ), z8 = _mm256_loadu_ps( z + i );
+			_mm256_storeu_ps( ox + i, Row8( r, x8, y8, z8 ) );
+			_mm256_storeu_ps( oy + i, Row8( r + 4, x8, y8, z8 ) );
+			_mm256_storeu_ps( oz + i, Row8( r + 8, x8, y8, z8 ) );
+		}
+	}
+	for (; i < count; i++)
+	{
+		const float3 p = TransformPosition( make_float3( x[i], y[i], z[i] ), M );
+		ox[i] = p.x, oy[i] = p.y, oz[i] = p.z;
+	}
+}
+void TransformPositions2D( const float2* in, float2* out, const int count, const mat4& M )
+{
+	int i = 0;
+	if (UseAVX2())
+	{
+		const __m256 m0 = _mm256_set1_ps( M.cell[0] ), m1 = _mm256_set1_ps( M.cell[1] ), m3 = _mm256_set1_ps( M.cell[3] );
+		const __m256 m4 = _mm256_set1_ps( M.cell[4] ), m5 = _mm256_set1_ps( M.cell[5] ), m7 = _mm256_set1_ps( M.cell[7] );
+		for (; i + 8 <= count; i += 8)
+		{
+			// deinterleave; lanes come out permuted, unpack restores the order
+			const __m256 a = _mm256_loadu_ps( &in[i].x ), b = _mm256_loadu_ps( &in[i + 4].x );
+			const __m256 x = _mm256_shuffle_ps( a, b, _MM_SHUFFLE( 2, 0, 2, 0 ) ), y = _mm256_shuffle_ps( a, b, _MM_SHUFFLE( 3, 1, 3, 1 ) );
+			const __m256 tx = _mm256_fmadd_ps( x, m0, _mm256_fmadd_ps( y, m1, m3 ) );
+			const __m256 ty = _mm256_fmadd_ps( x, m4, _mm256_fmadd_ps( y, m5, m7 ) );
+			_mm256_storeu_ps( &out[i].x, _mm256_unpacklo_ps( tx, ty ) );
+			_mm256_storeu_ps( &out[i + 4].x, _mm256_unpackhi_ps( tx, ty ) );
+		}
+	}
+	for (; i < count; i++)
+	{
+		const float2 p = in[i];
+		out[i] = make_float2( M.cell[0] * p.x + M.cell[1] * p.y + M.cell[3], M.cell[4] * p.x + M.cell[5] * p.y + M.cell[7] );
+	}
+}
+void TransformPositions2D( const float* x, const float* y, float* ox, float* oy, const int count, const mat4& M )
+{
+	int i = 0;
+	if (UseAVX2())
+	{
+		const __m256 m0 = _mm256_set1_ps( M.cell[0] ), m1 = _mm256_set1_ps( M.cell[1] ), m3 = _mm256_set1_ps( M.cell[3] );
+		const __m256 m4 = _mm256_set1_ps( M.cell[4] ), m5 = _mm256_set1_ps( M.cell[5] ), m7 = _mm256_set1_ps( M.cell[7] );
+		for (; i + 8 <= count; i += 8)
+		{
+			const __m256 x8 = _mm256_loadu_ps( x + i ), y8 = _mm256_loadu_ps( y + i );
+			_mm256_storeu_ps( ox + i, _mm256_fmadd_ps( x8, m0, _mm256_fmadd_ps( y8, m1, m3 ) ) );
+			_mm256_storeu_ps( oy + i, _mm256_fmadd_ps( x8, m4, _mm256_fmadd_ps( y8, m5, m7 ) ) );
+		}
+	}
+	for (; i < count; i++)
+	{
+		const float px = x[i], py = y[i];
+		ox[i] = M.cell[0] * px + M.cell[1] * py + M.cell[3], oy[i] = M.cell[4] * px + M.cell[5] * py + M.cell[7];
+	}
+}
+void ProjectPositions( const float3* in, float2* out, const int count, const mat4& M )
+{
+	int i = 0;
+	if (UseAVX2())
+	{
+		__m256 r[16];
+		SetupRows8( r, M, 1, 4 );
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256 x, y, z;
+			Load8( &in[i].x, x, y, z );
+			const __m256 rw = _mm256_div_ps( _mm256_set1_ps( 1 ), Row8( r + 12, x, y, z ) );
+			const __m256 px = _mm256_mul_ps( Row8( r, x, y, z ), rw ), py = _mm256_mul_ps( Row8( r + 4, x, y, z ), rw );
+			// Load8 leaves lanes in point order, so a plain interleave suffices
+			const __m256 lo = _mm256_unpacklo_ps( px, py ), hi = _mm256_unpackhi_ps( px, py );
+			_mm256_storeu_ps( &out[i].x, _mm256_permute2f128_ps( lo, hi, 0x20 ) );
+			_mm256_storeu_ps( &out[i + 4].x, _mm256_permute2f128_ps( lo, hi, 0x31 ) );
+		}
+	}
+	for (; i < count; i++)
+	{
+		const float4 p = make_float4( in[i], 1 ) * M;
+		out[i] = make_float2( p.x / p.w, p.y / p.w );
+	}
+}
+void ProjectPositions( const float* x, const float* y, const float* z, float* ox, float* oy, const int count, const mat4& M )
+{
+	int i = 0;
+	if (UseAVX2())
+	{
+		__m256 r[16];
+		SetupRows8( r, M, 1, 4 );
+		for (; i + 8 <= count; i += 8)
+		{
+			const __m256 x8 = _mm256_loadu_ps( x + i ), y8 = _mm256_loadu_ps( y + i ), z8 = _mm256_loadu_ps( z + i );
+			const __m256 rw = _mm256_div_ps( _mm256_set1_ps( 1 ), Row8( r + 12, x8, y8, z8 ) );
+			_mm256_storeu_ps( ox + i, _mm256_mul_ps( Row8( r, x8, y8, z8 ), rw ) );
+			_mm256_storeu_ps( oy + i, _mm256_mul_ps( Row8( r + 4, x8, y8, z8 ), rw ) );
+		}
+	}
+	for (; i < count; i++)
+	{
+		const float4 p = make_float4( x[i], y[i], z[i], 1 ) * M;
+		ox[i] = p.x / p.w, oy[i] = p.y / p.w;
+	}
+}
+
+// batched Perlin noise
+// Eight samples per AVX2 pass. Per octave, the 16 hashes of the 4x4 lattice block
+// around each sample are shared by the four SmoothedNoise calls of the scalar code.
+// Summation order matches the scalar code, so results agree to the last bit on
+// compilers that do not contract a * b + c into fma.
+static inline __m256 Noise8( const __m256i n0, const __m256i a, const __m256i b, const __m256i c )
+{
+	const __m256i n = _mm256_xor_si256( _mm256_slli_epi32( n0, 13 ), n0 );
+	const __m256i nna = _mm256_mullo_epi32( _mm256_mullo_epi32( n, n ), a );
+	__m256i t = _mm256_add_epi32( _mm256_mullo_epi32( n, _mm256_add_epi32( nna, b ) ), c );
+	t = _mm256_and_si256( t, _mm256_set1_epi32( 0x7fffffff ) );
+	return _mm256_sub_ps( _mm256_set1_ps( 1 ), _mm256_mul_ps( _mm256_cvtepi32_ps( t ), _mm256_set1_ps( 1.0f / 1073741824.0f ) ) );
+}
+static inline __m256 Interpolate8( const __m256 a, const __m256 b, const __m256 x )
+{
+	const __m256 half = _mm256_set1_ps( 0.5f ), t = _mm256_sub_ps( x, half ), t2 = _mm256_mul_ps( t, t );
+	__m256 p = _mm256_add_ps( _mm256_set1_ps( interpB ), _mm256_mul_ps( t2, _mm256_set1_ps( interpC ) ) );
+	p = _mm256_mul_ps( t, _mm256_add_ps( _mm256_set1_ps( interpA ), _mm256_mul_ps( t2, p ) ) );
+	const __m256 f = _mm256_add_ps( half, _mm256_mul_ps( half, p ) );
+	return _mm256_add_ps( _mm256_mul_ps( a, _mm256_sub_ps( _mm256_set1_ps( 1 ), f ) ), _mm256_mul_ps( b, f ) );
+}
+static inline __m256 Smoothed8( const __m256 N[4][4], const int cx, const int cy )
+{
+	const __m256 c = _mm256_add_ps( _mm256_add_ps( _mm256_add_ps( N[cy][cx], N[cy][cx + 2] ), N[cy + 2][cx] ), N[cy + 2][cx + 2] );
+	const __m256 s = _mm256_add_ps( _mm256_add_ps( _mm256_add_ps( N[cy + 1][cx], N[cy + 1][cx + 2] ), N[cy][cx + 1] ), N[cy + 2][cx + 1] );
+	const __m256 corners = _mm256_mul_ps( c, _mm256_set1_ps( 1.0f / 16 ) ), sides = _mm256_mul_ps( s, _mm256_set1_ps( 1.0f / 8 ) );
+	return _mm256_add_ps( _mm256_add_ps( corners, sides ), _mm256_mul_ps( N[cy + 1][cx + 1], _mm256_set1_ps( 1.0f / 4 ) ) );
+}
+static __m256 Noise2D8( const __m256 x, const __m256 y )
+{
+	__m256 total = _mm256_setzero_ps();
+	float frequency = (float)(2 << numOctaves), amplitude = 1;
+	for (int o = 0; o < numOctaves; o++)
+	{
+		frequency /= 2, amplitude *= persistence;
+		const int* prime = primes[(primeIndex + o) % 10];
+		const __m256i a = _mm256_set1_epi32( prime[0] ), b = _mm256_set1_epi32( prime[1] ), c = _mm256_set1_epi32( prime[2] );
+		// frequency is a power of two, so the reciprocal is exact
+		const __m256 rf = _mm256_set1_ps( 1 / frequency );
+		const __m256 sx = _mm256_mul_ps( x, rf ), sy = _mm256_mul_ps( y, rf );
+		const __m256i ix = _mm256_cvttps_epi32( sx ), iy = _mm256_cvttps_epi32( sy );
+		const __m256 fx = _mm256_sub_ps( sx, _mm256_cvtepi32_ps( ix ) ), fy = _mm256_sub_ps( sy, _mm256_cvtepi32_ps( iy ) );
+		const __m256i base = _mm256_add_epi32( ix, _mm256_mullo_epi32( iy, _mm256_set1_epi32( 57 ) ) );
+		__m256 N[4][4];
+		for (int v = 0; v < 4; v++) for (int u = 0; u < 4; u++)
+			N[v][u] = Noise8( _mm256_add_epi32( base, _mm256_set1_epi32( (u - 1) + (v - 1) * 57 ) ), a, b, c );
+		const __m256 i1 = Interpolate8( Smoothed8( N, 0, 0 ), Smoothed8( N, 1, 0 ), fx );
+		const __m256 i2 = Interpolate8( Smoothed8( N, 0, 1 ), Smoothed8( N, 1, 1 ), fx );
+		total = _mm256_add_ps( total, _mm256_mul_ps( Interpolate8( i1, i2, fy ), _mm256_set1_ps( amplitude ) ) );
+	}
+	return _mm256_div_ps( total, _mm256_set1_ps( frequency ) );
+}
+void noise2D( const float* x, const float* y, float* out, const int count )
+{
+	int i = 0;
+	if (UseAVX2()) for (; i + 8 <= count; i += 8)
+		_mm256_storeu_ps( out + i, Noise2D8( _mm256_loadu_ps( x + i ), _mm256_loadu_ps( y + i ) ) );
+	for (; i < count; i++) out[i] = noise2D( x[i], y[i] );
+}
+static void NoiseRows( float* out, const int width, const int first, const int last, const float x0, const float y0, const float dx, const float dy )
+{
+	float xs[256], ys[256];
+	for (int row = first; row < last; row++) for (int x = 0; x < width; x += 256)
+	{
+		const int n = min( 256, width - x );
+		for (int i = 0; i < n; i++) xs[i] = x0 + (x + i) * dx, ys[i] = y0 + row * dy;
+		noise2D( xs, ys, out + (size_t)row * width + x, n );
+	}
+}
+void noise2DField( float* out, const int width, const int height, const float x0, const float y0, const float dx, const float dy, const bool parallel )
+{
+	if (!parallel || height < 2) { NoiseRows( out, width, 0, height, x0, y0, dx, dy ); return; }
+	JobManager::GetJobManager()->ParallelFor( 0, height, max( 1, 4096 / max( 1, width ) ), [=]( int first, int last, JobContext& ) {
+		NoiseRows( out, width, first, last, x0, y0, dx, dy );
+	} );
+}
@@ -115,6 +115,7 @@ using namespace Tmpl8;
 template <class T> void Swap( T& x, T& y ) { T t; t = x, x = y, y = t; }
 
 // random numbers
+uint WangHash( uint s );
 uint InitSeed( uint seedBase );
 uint RandomUInt();
 uint RandomUInt( uint& seed );
@@ -873,6 +874,16 @@ float3 TransformPosition( const float3& a, const mat4& M );
 float3 TransformVector( const float3& a, const mat4& M );
 float3 TransformPosition_SSE( const __m128& a, const mat4& M );
 float3 TransformVector_SSE( const __m128& a, const mat4& M );
+// batched transforms: positions use M * (p, 1), vectors M * (v, 0); 8 points per
+// iteration on AVX2/FMA CPUs. The 2D variants apply the affine part of M (cells
+// 0, 1, 3 and 4, 5, 7); ProjectPositions divides x and y by w. In-place is fine.
+void TransformPositions( const float3* in, float3* out, const int count, const mat4& M );
+void TransformVectors( const float3* in, float3* out, const int count, const mat4& M );
+void TransformPositions( const float* x, const float* y, const float* z, float* ox, float* oy, float* oz, const int count, const mat4& M );
+void TransformPositions2D( const float2* in, float2* out, const int count, const mat4& M );
+void TransformPositions2D( const float* x, const float* y, float* ox, float* oy, const int count, const mat4& M );
+void ProjectPositions( const float3* in, float2* out, const int count, const mat4& M );
+void ProjectPositions( const float* x, const float* y, const float* z, float* ox, float* oy, const int count, const mat4& M );
 
 class quat // based on https://github.com/adafruit
 {
@@ -995,5 +1006,526 @@ public:
 	float w = 1, x = 0, y = 0, z = 0;
 };
 
+// wide SIMD types
+// floatx8 / floatx16 hold 8 or 16 floats; float2x8, float3x8, float2x16 and
+// float3x16 are SoA vectors built from them, so kernels can be written like the
+// float2 / float3 code above and run at full vector width. The backend is picked
+// at compile time: AVX-512 (__AVX512F__), AVX (__AVX__, set by /arch:AVX and
+// /arch:AVX2) or pairs of SSE registers. Comparisons yield a mask (maskx8,
+// maskx16) for use with select, any and all.
+#ifdef __AVX__
+struct ALIGN( 32 ) maskx8
+{
+	maskx8() = default;
+	maskx8( const __m256 a ) : v( a ) {}
+	int Bits() const { return _mm256_movemask_ps( v ); }
+	__m256 v;
+};
+struct ALIGN( 32 ) floatx8
+{
+	floatx8() = default;
+	floatx8( const float a ) : v( _mm256_set1_ps( a ) ) {}
+	floatx8( const __m256 a ) : v( a ) {}
+	static floatx8 Load( const float* p ) { return _mm256_load_ps( p ); }
+	static floatx8 LoadU( const float* p ) { return _mm256_loadu_ps( p ); }
+	void Store( float* p ) const { _mm256_store_ps( p, v ); }
+	void StoreU( float* p ) const { _mm256_storeu_ps( p, v ); }
+	__m256 v;
+};
+#define WIDE8_OP( op, f ) inline floatx8 operator op( const floatx8& a, const floatx8& b ) { return f( a.v, b.v ); }
+#define WIDE8_CMP( op, c ) inline maskx8 operator op( const floatx8& a, const floatx8& b ) { return _mm256_cmp_ps( a.v, b.v, c ); }
+#define WIDE8_FUNC( name, f ) inline floatx8 name( const floatx8& a, const floatx8& b ) { return f( a.v, b.v ); }
+#define WIDE8_MASK( op, f ) inline maskx8 operator op( const maskx8& a, const maskx8& b ) { return f( a.v, b.v ); }
+WIDE8_CMP( <, _CMP_LT_OQ ) WIDE8_CMP( <=, _CMP_LE_OQ ) WIDE8_CMP( >, _CMP_GT_OQ )
+WIDE8_CMP( >=, _CMP_GE_OQ ) WIDE8_CMP( ==, _CMP_EQ_OQ ) WIDE8_CMP( !=, _CMP_NEQ_UQ )
+inline maskx8 operator~( const maskx8& a ) { return _mm256_xor_ps( a.v, _mm256_castsi256_ps( _mm256_set1_epi32( -1 ) ) ); }
+inline floatx8 operator-( const floatx8& a ) { return _mm256_xor_ps( a.v, _mm256_set1_ps( -0.0f ) ); }
+inline floatx8 select( const maskx8& m, const floatx8& a, const floatx8& b ) { return _mm256_blendv_ps( b.v, a.v, m.v ); }
+inline floatx8 sqrt( const floatx8& a ) { return _mm256_sqrt_ps( a.v ); }
+inline floatx8 abs( const floatx8& a ) { return _mm256_andnot_ps( _mm256_set1_ps( -0.0f ), a.v ); }
+#ifdef __AVX2__
+inline floatx8 fmadd( const floatx8& a, const floatx8& b, const floatx8& c ) { return _mm256_fmadd_ps( a.v, b.v, c.v ); }
+#else
+inline floatx8 fmadd( const floatx8& a, const floatx8& b, const floatx8& c ) { return _mm256_add_ps( _mm256_mul_ps( a.v, b.v ), c.v ); }
+#endif
+inline float hsum( const floatx8& a )
+{
+	const __m128 s = _mm_add_ps( _mm256_castps256_ps128( a.v ), _mm256_extractf128_ps( a.v, 1 ) );
+	const __m128 t = _mm_add_ps( s, _mm_movehl_ps( s, s ) );
+	return _mm_cvtss_f32( _mm_add_ss( t, _mm_shuffle_ps( t, t, 1 ) ) );
+}
+inline float hmin( const floatx8& a )
+{
+	const __m128 s = _mm_min_ps( _mm256_castps256_ps128( a.v ), _mm256_extractf128_ps( a.v, 1 ) );
+	const __m128 t = _mm_min_ps( s, _mm_movehl_ps( s, s ) );
+	return _mm_cvtss_f32( _mm_min_ss( t, _mm_shuffle_ps( t, t, 1 ) ) );
+}
+inline float hmax( const floatx8& a )
+{
+	const __m128 s = _mm_max_ps( _mm256_castps256_ps128( a.v ), _mm256_extractf128_ps( a.v, 1 ) );
+	const __m128 t = _mm_max_ps( s, _mm_movehl_ps( s, s ) );
+	return _mm_cvtss_f32( _mm_max_ss( t, _mm_shuffle_ps( t, t, 1 ) ) );
+}
+#else
+struct ALIGN( 16 ) maskx8
+{
+	maskx8() = default;
+	maskx8( const __m128 a, const __m128 b ) : lo( a ), hi( b ) {}
+	int Bits() const { return _mm_movemask_ps( lo ) | (_mm_movemask_ps( hi ) << 4); }
+	__m128 lo, hi;
+};
+struct ALIGN( 16 ) floatx8
+{
+	floatx8() = default;
+	floatx8( const float a ) : lo( _mm_set1_ps( a ) ), hi( lo ) {}
+	floatx8( const __m128 a, const __m128 b ) : lo( a ), hi( b ) {}
+	static floatx8 Load( const float* p ) { return floatx8( _mm_load_ps( p ), _mm_load_ps( p + 4 ) ); }
+	static floatx8 LoadU( const float* p ) { return floatx8( _mm_loadu_ps( p ), _mm_loadu_ps( p + 4 ) ); }
+	void Store( float* p ) const { _mm_store_ps( p, lo ), _mm_store_ps( p + 4, hi ); }
+	void StoreU( float* p ) const { _mm_storeu_ps( p, lo ), _mm_storeu_ps( p + 4, hi ); }
+	__m128 lo, hi;
+};
+#define WIDE8_OP( op, f ) inline floatx8 operator op( const floatx8& a, const floatx8& b ) { return floatx8( f( a.lo, b.lo ), f( a.hi, b.hi ) ); }
+#define WIDE8_CMP( op, f ) inline maskx8 operator op( const floatx8& a, const floatx8& b ) { return maskx8( f( a.lo, b.lo ), f( a.hi, b.hi ) ); }
+#define WIDE8_FUNC( name, f ) inline floatx8 name( const floatx8& a, const floatx8& b ) { return floatx8( f( a.lo, b.lo ), f( a.hi, b.hi ) ); }
+#define WIDE8_MASK( op, f ) inline maskx8 operator op( const maskx8& a, const maskx8& b ) { return maskx8( f( a.lo, b.lo ), f( a.hi, b.hi ) ); }
+WIDE8_CMP( <, _mm_cmplt_ps ) WIDE8_CMP( <=, _mm_cmple_ps ) WIDE8_CMP( >, _mm_cmpgt_ps )
+WIDE8_CMP( >=, _mm_cmpge_ps ) WIDE8_CMP( ==, _mm_cmpeq_ps ) WIDE8_CMP( !=, _mm_cmpneq_ps )
+inline maskx8 operator~( const maskx8& a ) { const __m128 t = _mm_castsi128_ps( _mm_set1_epi32( -1 ) ); return maskx8( _mm_xor_ps( a.lo, t ), _mm_xor_ps( a.hi, t ) ); }
+inline floatx8 operator-( const floatx8& a ) { const __m128 s = _mm_set1_ps( -0.0f ); return floatx8( _mm_xor_ps( a.lo, s ), _mm_xor_ps( a.hi, s ) ); }
+inline floatx8 select( const maskx8& m, const floatx8& a, const floatx8& b )
+{
+	return floatx8( _mm_or_ps( _mm_and_ps( m.lo, a.lo ), _mm_andnot_ps( m.lo, b.lo ) ), _mm_or_ps( _mm_and_ps( m.hi, a.hi ), _mm_andnot_ps( m.hi, b.hi ) ) );
+}
+inline floatx8 sqrt( const floatx8& a ) { return floatx8( _mm_sqrt_ps( a.lo ), _mm_sqrt_ps( a.hi ) ); }
+inline floatx8 abs( const floatx8& a ) { const __m128 s = _mm_set1_ps( -0.0f ); return floatx8( _mm_andnot_ps( s, a.lo ), _mm_andnot_ps( s, a.hi ) ); }
+inline floatx8 fmadd( const floatx8& a, const floatx8& b, const floatx8& c )
+{
+	return floatx8( _mm_add_ps( _mm_mul_ps( a.lo, b.lo ), c.lo ), _mm_add_ps( _mm_mul_ps( a.hi, b.hi ), c.hi ) );
+}
+inline float hsum( const floatx8& a )
+{
+	const __m128 s = _mm_add_ps( a.lo, a.hi ), t = _mm_add_ps( s, _mm_movehl_ps( s, s ) );
+	return _mm_cvtss_f32( _mm_add_ss( t, _mm_shuffle_ps( t, t, 1 ) ) );
+}
+inline float hmin( const floatx8& a )
+{
+	const __m128 s = _mm_min_ps( a.lo, a.hi ), t = _mm_min_ps( s, _mm_movehl_ps( s, s ) );
+	return _mm_cvtss_f32( _mm_min_ss( t, _mm_shuffle_ps( t, t, 1 ) ) );
+}
+inline float hmax( const floatx8& a )
+{
+	const __m128 s = _mm_max_ps( a.lo, a.hi ), t = _mm_max_ps( s, _mm_movehl_ps( s, s ) );
+	return _mm_cvtss_f32( _mm_max_ss( t, _mm_shuffle_ps( t, t, 1 ) ) );
+}
+#endif
+#ifdef __AVX__
+#define WIDE8_IMPL( a ) _mm256_##a##_ps
+#else
+#define WIDE8_IMPL( a ) _mm_##a##_ps
+#endif
+WIDE8_OP( +, WIDE8_IMPL( add ) ) WIDE8_OP( -, WIDE8_IMPL( sub ) ) WIDE8_OP( *, WIDE8_IMPL( mul ) ) WIDE8_OP( /, WIDE8_IMPL( div ) )
+WIDE8_FUNC( min, WIDE8_IMPL( min ) ) WIDE8_FUNC( max, WIDE8_IMPL( max ) )
+WIDE8_MASK( &, WIDE8_IMPL( and ) ) WIDE8_MASK( |, WIDE8_IMPL( or ) ) WIDE8_MASK( ^, WIDE8_IMPL( xor ) )
+#undef WIDE8_OP
+#undef WIDE8_CMP
+#undef WIDE8_FUNC
+#undef WIDE8_MASK
+#undef WIDE8_IMPL
+inline floatx8 rsqrt( const floatx8& a ) { return floatx8( 1.0f ) / sqrt( a ); }
+inline bool any( const maskx8& m ) { return m.Bits() != 0; }
+inline bool all( const maskx8& m ) { return m.Bits() == 255; }
+// floor, and table lookups; indices are integer-valued floats, so they can be computed
+// with the float ops above. AVX2 builds use hardware gathers.
+#ifdef __AVX__
+inline floatx8 floor( const floatx8& a ) { return _mm256_floor_ps( a.v ); }
+#else
+inline floatx8 floor( const floatx8& a )
+{
+	// truncate, then step down where truncation rounded up (negative fractions)
+	const __m128 one = _mm_set1_ps( 1 );
+	const __m128 tl = _mm_cvtepi32_ps( _mm_cvttps_epi32( a.lo ) ), th = _mm_cvtepi32_ps( _mm_cvttps_epi32( a.hi ) );
+	return floatx8( _mm_sub_ps( tl, _mm_and_ps( _mm_cmpgt_ps( tl, a.lo ), one ) ), _mm_sub_ps( th, _mm_and_ps( _mm_cmpgt_ps( th, a.hi ), one ) ) );
+}
+#endif
+#ifdef __AVX2__
+inline floatx8 gather( const float* table, const floatx8& index ) { return _mm256_i32gather_ps( table, _mm256_cvttps_epi32( index.v ), 4 ); }
+#else
+inline floatx8 gather( const float* table, const floatx8& index )
+{
+	ALIGN( 32 ) float i[8], r[8];
+	index.Store( i );
+	for (int k = 0; k < 8; k++) r[k] = table[(int)i[k]];
+	return floatx8::Load( r );
+}
+#endif
+
+#ifdef __AVX512F__
+struct ALIGN( 64 ) maskx16
+{
+	maskx16() = default;
+	maskx16( const __mmask16 a ) : m( a ) {}
+	int Bits() const { return m; }
+	__mmask16 m;
+};
+struct ALIGN( 64 ) floatx16
+{
+	floatx16() = default;
+	floatx16( const float a ) : v( _mm512_set1_ps( a ) ) {}
+	floatx16( const __m512 a ) : v( a ) {}
+	static floatx16 Load( const float* p ) { return _mm512_load_ps( p ); }
+	static floatx16 LoadU( const float* p ) { return _mm512_loadu_ps( p ); }
+	void Store( float* p ) const { _mm512_store_ps( p, v ); }
+	void StoreU( float* p ) const { _mm512_storeu_ps( p, v ); }
+	__m512 v;
+};
+#define WIDE16_OP( op, f ) inline floatx16 operator op( const floatx16& a, const floatx16& b ) { return f( a.v, b.v ); }
+#define WIDE16_CMP( op, c ) inline maskx16 operator op( const floatx16& a, const floatx16& b ) { return _mm512_cmp_ps_mask( a.v, b.v, c ); }
+WIDE16_OP( +, _mm512_add_ps ) WIDE16_OP( -, _mm512_sub_ps ) WIDE16_OP( *, _mm512_mul_ps ) WIDE16_OP( /, _mm512_div_ps )
+WIDE16_CMP( <, _CMP_LT_OQ ) WIDE16_CMP( <=, _CMP_LE_OQ ) WIDE16_CMP( >, _CMP_GT_OQ )
+WIDE16_CMP( >=, _CMP_GE_OQ ) WIDE16_CMP( ==, _CMP_EQ_OQ ) WIDE16_CMP( !=, _CMP_NEQ_UQ )
+#undef WIDE16_OP
+#undef WIDE16_CMP
+inline maskx16 operator&( const maskx16& a, const maskx16& b ) { return (__mmask16)(a.m & b.m); }
+inline maskx16 operator|( const maskx16& a, const maskx16& b ) { return (__mmask16)(a.m | b.m); }
+inline maskx16 operator^( const maskx16& a, const maskx16& b ) { return (__mmask16)(a.m ^ b.m); }
+inline maskx16 operator~( const maskx16& a ) { return (__mmask16)~a.m; }
+inline floatx16 operator-( const floatx16& a ) { return _mm512_sub_ps( _mm512_setzero_ps(), a.v ); }
+inline floatx16 select( const maskx16& m, const floatx16& a, const floatx16& b ) { return _mm512_mask_blend_ps( m.m, b.v, a.v ); }
+inline floatx16 min( const floatx16& a, const floatx16& b ) { return _mm512_min_ps( a.v, b.v ); }
+inline floatx16 max( const floatx16& a, const floatx16& b ) { return _mm512_max_ps( a.v, b.v ); }
+inline floatx16 sqrt( const floatx16& a ) { return _mm512_sqrt_ps( a.v ); }
+inline floatx16 abs( const floatx16& a ) { return _mm512_abs_ps( a.v ); }
+inline floatx16 fmadd( const floatx16& a, const floatx16& b, const floatx16& c ) { return _mm512_fmadd_ps( a.v, b.v, c.v ); }
+inline float hsum( const floatx16& a ) { return _mm512_reduce_add_ps( a.v ); }
+inline float hmin( const floatx16& a ) { return _mm512_reduce_min_ps( a.v ); }
+inline float hmax( const floatx16& a ) { return _mm512_reduce_max_ps( a.v ); }
+#else
+struct maskx16
+{
+	maskx16() = default;
+	maskx16( const maskx8& a, const maskx8& b ) : lo( a ), hi( b ) {}
+	int Bits() const { return lo.Bits() | (hi.Bits() << 8); }
+	maskx8 lo, hi;
+};
+struct floatx16
+{
+	floatx16() = default;
+	floatx16( const float a ) : lo( a ), hi( a ) {}
+	floatx16( const floatx8& a, const floatx8& b ) : lo( a ), hi( b ) {}
+	static floatx16 Load( const float* p ) { return floatx16( floatx8::Load( p ), floatx8::Load( p + 8 ) ); }
+	static floatx16 LoadU( const float* p ) { return floatx16( floatx8::LoadU( p ), floatx8::LoadU( p + 8 ) ); }
+	void Store( float* p ) const { lo.Store( p ), hi.Store( p + 8 ); }
+	void StoreU( float* p ) const { lo.StoreU( p ), hi.StoreU( p + 8 ); }
+	floatx8 lo, hi;
+};
+#define WIDE16_OP( op ) inline floatx16 operator op( const floatx16& a, const floatx16& b ) { return floatx16( a.lo op b.lo, a.hi op b.hi ); }
+#define WIDE16_CMP( op ) inline maskx16 operator op( const floatx16& a, const floatx16& b ) { return maskx16( a.lo op b.lo, a.hi op b.hi ); }
+#define WIDE16_MASK( op ) inline maskx16 operator op( const maskx16& a, const maskx16& b ) { return maskx16( a.lo op b.lo, a.hi op b.hi ); }
+WIDE16_OP( + ) WIDE16_OP( - ) WIDE16_OP( * ) WIDE16_OP( / )
+WIDE16_CMP( < ) WIDE16_CMP( <= ) WIDE16_CMP( > ) WIDE16_CMP( >= ) WIDE16_CMP( == ) WIDE16_CMP( != )
+WIDE16_MASK( & ) WIDE16_MASK( | ) WIDE16_MASK( ^ )
+#undef WIDE16_OP
+#undef WIDE16_CMP
+#undef WIDE16_MASK
+inline maskx16 operator~( const maskx16& a ) { return maskx16( ~a.lo, ~a.hi ); }
+inline floatx16 operator-( const floatx16& a ) { return floatx16( -a.lo, -a.hi ); }
+inline floatx16 select( const maskx16& m, const floatx16& a, const floatx16& b ) { return floatx16( select( m.lo, a.lo, b.lo ), select( m.hi, a.hi, b.hi ) ); }
+inline floatx16 min( const floatx16& a, const floatx16& b ) { return floatx16( min( a.lo, b.lo ), min( a.hi, b.hi ) ); }
+inline floatx16 max( const floatx16& a, const floatx16& b ) { return floatx16( max( a.lo, b.lo ), max( a.hi, b.hi ) ); }
+inline floatx16 sqrt( const floatx16& a ) { return floatx16( sqrt( a.lo ), sqrt( a.hi ) ); }
+inline floatx16 abs( const floatx16& a ) { return floatx16( abs( a.lo ), abs( a.hi ) ); }
+inline floatx16 fmadd( const floatx16& a, const floatx16& b, const floatx16& c ) { return floatx16( fmadd( a.lo, b.lo, c.lo ), fmadd( a.hi, b.hi, c.hi ) ); }
+inline float hsum( const floatx16& a ) { return hsum( a.lo + a.hi ); }
+inline float hmin( const floatx16& a ) { return hmin( min( a.lo, a.hi ) ); }
+inline float hmax( const floatx16& a ) { return hmax( max( a.lo, a.hi ) ); }
+#endif
+inline floatx16 rsqrt( const floatx16& a ) { return floatx16( 1.0f ) / sqrt( a ); }
+inline bool any( const maskx16& m ) { return m.Bits() != 0; }
+inline bool all( const maskx16& m ) { return m.Bits() == 0xffff; }
+#ifdef __AVX512F__
+inline floatx16 floor( const floatx16& a ) { return _mm512_roundscale_ps( a.v, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC ); }
+inline floatx16 gather( const float* table, const floatx16& index ) { return _mm512_i32gather_ps( _mm512_cvttps_epi32( index.v ), table, 4 ); }
+#else
+inline floatx16 floor( const floatx16& a ) { return floatx16( floor( a.lo ), floor( a.hi ) ); }
+inline floatx16 gather( const float* table, const floatx16& index ) { return floatx16( gather( table, index.lo ), gather( table, index.hi ) ); }
+#endif
+
+// SoA vectors; F is floatx8 or floatx16
+template <class F> struct wide2
+{
+	typedef F lane;
+	wide2() = default;
+	wide2( const F& a, const F& b ) : x( a ), y( b ) {}
+	wide2( const float2& a ) : x( a.x ), y( a.y ) {}
+	F x, y;
+};
+template <class F> struct wide3
+{
+	typedef F lane;
+	wide3() = default;
+	wide3( const F& a, const F& b, const F& c ) : x( a ), y( b ), z( c ) {}
+	wide3( const float3& a ) : x( a.x ), y( a.y ), z( a.z ) {}
+	F x, y, z;
+};
+typedef wide2<floatx8> float2x8;
+typedef wide3<floatx8> float3x8;
+typedef wide2<floatx16> float2x16;
+typedef wide3<floatx16> float3x16;
+
+#define WIDEV_OP( op ) \
+template <class F> inline wide2<F> operator op( const wide2<F>& a, const wide2<F>& b ) { return wide2<F>( a.x op b.x, a.y op b.y ); } \
+template <class F> inline wide2<F> operator op( const wide2<F>& a, const typename wide2<F>::lane& b ) { return wide2<F>( a.x op b, a.y op b ); } \
+template <class F> inline wide2<F> operator op( const typename wide2<F>::lane& a, const wide2<F>& b ) { return wide2<F>( a op b.x, a op b.y ); } \
+template <class F> inline void operator op##=( wide2<F>& a, const wide2<F>& b ) { a.x = a.x op b.x, a.y = a.y op b.y; } \
+template <class F> inline void operator op##=( wide2<F>& a, const typename wide2<F>::lane& b ) { a.x = a.x op b, a.y = a.y op b; } \
+template <class F> inline wide3<F> operator op( const wide3<F>& a, const wide3<F>& b ) { return wide3<F>( a.x op b.x, a.y op b.y, a.z op b.z ); } \
+template <class F> inline wide3<F> operator op( const wide3<F>& a, const typename wide3<F>::lane& b ) { return wide3<F>( a.x op b, a.y op b, a.z op b ); } \
+template <class F> inline wide3<F> operator op( const typename wide3<F>::lane& a, const wide3<F>& b ) { return wide3<F>( a op b.x, a op b.y, a op b.z ); } \
+template <class F> inline void operator op##=( wide3<F>& a, const wide3<F>& b ) { a.x = a.x op b.x, a.y = a.y op b.y, a.z = a.z op b.z; } \
+template <class F> inline void operator op##=( wide3<F>& a, const typename wide3<F>::lane& b ) { a.x = a.x op b, a.y = a.y op b, a.z = a.z op b; }
+WIDEV_OP( + ) WIDEV_OP( - ) WIDEV_OP( * ) WIDEV_OP( / )
+#undef WIDEV_OP
+template <class F> inline wide2<F> operator-( const wide2<F>& a ) { return wide2<F>( -a.x, -a.y ); }
+template <class F> inline wide3<F> operator-( const wide3<F>& a ) { return wide3<F>( -a.x, -a.y, -a.z ); }
+template <class F> inline F dot( const wide2<F>& a, const wide2<F>& b ) { return fmadd( a.x, b.x, a.y * b.y ); }
+template <class F> inline F dot( const wide3<F>& a, const wide3<F>& b ) { return fmadd( a.x, b.x, fmadd( a.y, b.y, a.z * b.z ) ); }
+template <class F> inline F length( const wide2<F>& v ) { return sqrt( dot( v, v ) ); }
+template <class F> inline F length( const wide3<F>& v ) { return sqrt( dot( v, v ) ); }
+template <class F> inline wide2<F> normalize( const wide2<F>& v ) { return v * rsqrt( dot( v, v ) ); }
+template <class F> inline wide3<F> normalize( const wide3<F>& v ) { return v * rsqrt( dot( v, v ) ); }
+template <class F> inline wide2<F> min( const wide2<F>& a, const wide2<F>& b ) { return wide2<F>( min( a.x, b.x ), min( a.y, b.y ) ); }
+template <class F> inline wide3<F> min( const wide3<F>& a, const wide3<F>& b ) { return wide3<F>( min( a.x, b.x ), min( a.y, b.y ), min( a.z, b.z ) ); }
+template <class F> inline wide2<F> max( const wide2<F>& a, const wide2<F>& b ) { return wide2<F>( max( a.x, b.x ), max( a.y, b.y ) ); }
+template <class F> inline wide3<F> max( const wide3<F>& a, const wide3<F>& b ) { return wide3<F>( max( a.x, b.x ), max( a.y, b.y ), max( a.z, b.z ) ); }
+template <class F, class M> inline wide2<F> select( const M& m, const wide2<F>& a, const wide2<F>& b ) { return wide2<F>( select( m, a.x, b.x ), select( m, a.y, b.y ) ); }
+template <class F, class M> inline wide3<F> select( const M& m, const wide3<F>& a, const wide3<F>& b ) { return wide3<F>( select( m, a.x, b.x ), select( m, a.y, b.y ), select( m, a.z, b.z ) ); }
+
+// fast math: rsqrt, rcp and length with selectable precision
+//   FastMath::PRECISE - sqrt and divide; exact up to rounding.
+//   FastMath::REFINED - hardware estimate plus one Newton-Raphson step;
+//                       relative error below 3e-7 (rsqrt, length) and 2e-7 (rcp).
+//   FastMath::APPROX  - raw hardware estimate; relative error below 3.7e-4
+//                       (1.5 * 2^-12; AVX-512 estimates are good to 2^-14).
+// Choose per call site with the template argument, e.g. fast_rsqrt<FastMath::APPROX>( x ),
+// or globally by defining FASTMATH_PRECISION before including this header.
+// Works on float, floatx8 and floatx16; fast_length also on float2/3 and wide2/3.
+// Estimates are meant for positive, finite input: rsqrt( 0 ) is NaN when refined,
+// so fast_length treats zero-length vectors explicitly. The bounds above are
+// checked over 1e-6 .. 1e6 by CheckFastMath (fastmathcheck.cpp).
+struct FastMath { enum { PRECISE = 0, REFINED = 1, APPROX = 2 }; };
+#ifndef FASTMATH_PRECISION
+#define FASTMATH_PRECISION FastMath::REFINED
+#endif
+inline float rsqrt_est( const float x ) { return _mm_cvtss_f32( _mm_rsqrt_ss( _mm_set_ss( x ) ) ); }
+inline float rcp_est( const float x ) { return _mm_cvtss_f32( _mm_rcp_ss( _mm_set_ss( x ) ) ); }
+#ifdef __AVX__
+inline floatx8 rsqrt_est( const floatx8& x ) { return _mm256_rsqrt_ps( x.v ); }
+inline floatx8 rcp_est( const floatx8& x ) { return _mm256_rcp_ps( x.v ); }
+#else
+inline floatx8 rsqrt_est( const floatx8& x ) { return floatx8( _mm_rsqrt_ps( x.lo ), _mm_rsqrt_ps( x.hi ) ); }
+inline floatx8 rcp_est( const floatx8& x ) { return floatx8( _mm_rcp_ps( x.lo ), _mm_rcp_ps( x.hi ) ); }
+#endif
+#ifdef __AVX512F__
+inline floatx16 rsqrt_est( const floatx16& x ) { return _mm512_rsqrt14_ps( x.v ); }
+inline floatx16 rcp_est( const floatx16& x ) { return _mm512_rcp14_ps( x.v ); }
+#else
+inline floatx16 rsqrt_est( const floatx16& x ) { return floatx16( rsqrt_est( x.lo ), rsqrt_est( x.hi ) ); }
+inline floatx16 rcp_est( const floatx16& x ) { return floatx16( rcp_est( x.lo ), rcp_est( x.hi ) ); }
+#endif
+template <int P = FASTMATH_PRECISION, class F> inline F fast_rsqrt( const F& x )
+{
+	if constexpr (P == FastMath::PRECISE) return F( 1.0f ) / sqrt( x );
+	const F e = rsqrt_est( x );
+	if constexpr (P == FastMath::APPROX) return e;
+	return e * (F( 1.5f ) - F( 0.5f ) * x * e * e);
+}
+template <int P = FASTMATH_PRECISION, class F> inline F fast_rcp( const F& x )
+{
+	if constexpr (P == FastMath::PRECISE) return F( 1.0f ) / x;
+	const F e = rcp_est( x );
+	if constexpr (P == FastMath::APPROX) return e;
+	return e * (F( 2.0f ) - x * e);
+}
+template <int P = FASTMATH_PRECISION> inline float fast_sqrt( const float d )
+{
+	if constexpr (P == FastMath::PRECISE) return sqrtf( d );
+	return d > 0 ? d * fast_rsqrt<P>( d ) : 0;
+}
+template <int P = FASTMATH_PRECISION, class F> inline F fast_sqrt( const F& d )
+{
+	if constexpr (P == FastMath::PRECISE) return sqrt( d );
+	return select( d > F( 0.0f ), d * fast_rsqrt<P>( d ), F( 0.0f ) );
+}
+template <int P = FASTMATH_PRECISION> inline float fast_length( const float2& v ) { return fast_sqrt<P>( dot( v, v ) ); }
+template <int P = FASTMATH_PRECISION> inline float fast_length( const float3& v ) { return fast_sqrt<P>( dot( v, v ) ); }
+template <int P = FASTMATH_PRECISION, class F> inline F fast_length( const wide2<F>& v ) { return fast_sqrt<P>( dot( v, v ) ); }
+template <int P = FASTMATH_PRECISION, class F> inline F fast_length( const wide3<F>& v ) { return fast_sqrt<P>( dot( v, v ) ); }
+
+// wide random number generators
+// RandomX8 and RandomX16 run 8 or 16 independent xorshift32 streams, one per
+// lane, so SIMD kernels can draw random numbers without leaving registers.
+// Lane i starts at WangHash( seed * lanes + i + 1 ) and then produces the same
+// sequence as RandomUInt( laneSeed ). Floats are built from the top 24 bits and
+// lie in [0,1); the scalar RandomFloat occasionally rounds up to 1.
+#ifdef __AVX2__
+struct ALIGN( 32 ) uintx8
+{
+	uintx8() = default;
+	uintx8( const __m256i a ) : v( a ) {}
+	static uintx8 Load( const uint* p ) { return _mm256_load_si256( (const __m256i*)p ); }
+	void Store( uint* p ) const { _mm256_store_si256( (__m256i*)p, v ); }
+	void StoreU( uint* p ) const { _mm256_storeu_si256( (__m256i*)p, v ); }
+	__m256i v;
+};
+#else
+struct ALIGN( 16 ) uintx8
+{
+	uintx8() = default;
+	uintx8( const __m128i a, const __m128i b ) : lo( a ), hi( b ) {}
+	static uintx8 Load( const uint* p ) { return uintx8( _mm_load_si128( (const __m128i*)p ), _mm_load_si128( (const __m128i*)p + 1 ) ); }
+	void Store( uint* p ) const { _mm_store_si128( (__m128i*)p, lo ), _mm_store_si128( (__m128i*)p + 1, hi ); }
+	void StoreU( uint* p ) const { _mm_storeu_si128( (__m128i*)p, lo ), _mm_storeu_si128( (__m128i*)p + 1, hi ); }
+	__m128i lo, hi;
+};
+#endif
+#ifdef __AVX512F__
+struct ALIGN( 64 ) uintx16
+{
+	uintx16() = default;
+	uintx16( const __m512i a ) : v( a ) {}
+	static uintx16 Load( const uint* p ) { return _mm512_load_si512( p ); }
+	void Store( uint* p ) const { _mm512_store_si512( p, v ); }
+	void StoreU( uint* p ) const { _mm512_storeu_si512( p, v ); }
+	__m512i v;
+};
+#else
+struct uintx16
+{
+	uintx16() = default;
+	uintx16( const uintx8& a, const uintx8& b ) : lo( a ), hi( b ) {}
+	static uintx16 Load( const uint* p ) { return uintx16( uintx8::Load( p ), uintx8::Load( p + 8 ) ); }
+	void Store( uint* p ) const { lo.Store( p ), hi.Store( p + 8 ); }
+	void StoreU( uint* p ) const { lo.StoreU( p ), hi.StoreU( p + 8 ); }
+	uintx8 lo, hi;
+};
+#endif
+// per-lane flag test: lanes where a and bits share a set bit, as a mask for select
+#ifdef __AVX2__
+inline maskx8 testbits( const uintx8& a, const uintx8& bits )
+{
+	const __m256i none = _mm256_cmpeq_epi32( _mm256_and_si256( a.v, bits.v ), _mm256_setzero_si256() );
+	return _mm256_castsi256_ps( _mm256_xor_si256( none, _mm256_set1_epi32( -1 ) ) );
+}
+#else
+inline maskx8 testbits( const uintx8& a, const uintx8& bits )
+{
+	const __m128i zero = _mm_setzero_si128(), ones = _mm_set1_epi32( -1 );
+	const __m128 lo = _mm_castsi128_ps( _mm_xor_si128( _mm_cmpeq_epi32( _mm_and_si128( a.lo, bits.lo ), zero ), ones ) );
+	const __m128 hi = _mm_castsi128_ps( _mm_xor_si128( _mm_cmpeq_epi32( _mm_and_si128( a.hi, bits.hi ), zero ), ones ) );
+#ifdef __AVX__
+	return _mm256_insertf128_ps( _mm256_castps128_ps256( lo ), hi, 1 );
+#else
+	return maskx8( lo, hi );
+#endif
+}
+#endif
+// table access with integer indices; lanes that scatter to the same index must hold the same value
+#ifdef __AVX2__
+inline floatx8 gather( const float* table, const uintx8& index ) { return _mm256_i32gather_ps( table, index.v, 4 ); }
+#else
+inline floatx8 gather( const float* table, const uintx8& index )
+{
+	ALIGN( 32 ) uint i[8];
+	ALIGN( 32 ) float r[8];
+	index.Store( i );
+	for (int k = 0; k < 8; k++) r[k] = table[i[k]];
+	return floatx8::Load( r );
+}
+#endif
+inline void scatter( float* table, const uintx8& index, const floatx8& v )
+{
+	ALIGN( 32 ) uint i[8];
+	ALIGN( 32 ) float r[8];
+	index.Store( i ), v.Store( r );
+	for (int k = 0; k < 8; k++) table[i[k]] = r[k];
+}
+class RandomX8
+{
+public:
+	RandomX8( const uint seed = 0 ) { Seed( seed ); }
+	void Seed( const uint seed )
+	{
+		ALIGN( 32 ) uint s[8];
+		for (int i = 0; i < 8; i++) s[i] = WangHash( seed * 8 + i + 1 ), s[i] += s[i] == 0; // zero is a fixed point
+		state = uintx8::Load( s );
+	}
+	uintx8 NextUInt8() { Step( state ); return state; }
+	floatx8 NextFloat8() { Step( state ); return ToFloat( state ); }
+	floatx8 Rand8( const floatx8& range ) { return NextFloat8() * range; }
+	// building blocks, shared with RandomX16
+#ifdef __AVX2__
+	static void Step( uintx8& s )
+	{
+		s.v = _mm256_xor_si256( s.v, _mm256_slli_epi32( s.v, 13 ) );
+		s.v = _mm256_xor_si256( s.v, _mm256_srli_epi32( s.v, 17 ) );
+		s.v = _mm256_xor_si256( s.v, _mm256_slli_epi32( s.v, 5 ) );
+	}
+	static floatx8 ToFloat( const uintx8& s ) { return _mm256_mul_ps( _mm256_cvtepi32_ps( _mm256_srli_epi32( s.v, 8 ) ), _mm256_set1_ps( 1.0f / 16777216 ) ); }
+#else
+	static __m128i Step( __m128i s )
+	{
+		s = _mm_xor_si128( s, _mm_slli_epi32( s, 13 ) );
+		s = _mm_xor_si128( s, _mm_srli_epi32( s, 17 ) );
+		return _mm_xor_si128( s, _mm_slli_epi32( s, 5 ) );
+	}
+	static void Step( uintx8& s ) { s.lo = Step( s.lo ), s.hi = Step( s.hi ); }
+	static floatx8 ToFloat( const uintx8& s )
+	{
+		const __m128 scale = _mm_set1_ps( 1.0f / 16777216 );
+		const __m128 lo = _mm_mul_ps( _mm_cvtepi32_ps( _mm_srli_epi32( s.lo, 8 ) ), scale );
+		const __m128 hi = _mm_mul_ps( _mm_cvtepi32_ps( _mm_srli_epi32( s.hi, 8 ) ), scale );
+	#ifdef __AVX__
+		return _mm256_insertf128_ps( _mm256_castps128_ps256( lo ), hi, 1 );
+	#else
+		return floatx8( lo, hi );
+	#endif
+	}
+#endif
+private:
+	uintx8 state;
+};
+class RandomX16
+{
+public:
+	RandomX16( const uint seed = 0 ) { Seed( seed ); }
+	void Seed( const uint seed )
+	{
+		ALIGN( 64 ) uint s[16];
+		for (int i = 0; i < 16; i++) s[i] = WangHash( seed * 16 + i + 1 ), s[i] += s[i] == 0;
+		state = uintx16::Load( s );
+	}
+#ifdef __AVX512F__
+	uintx16 NextUInt16()
+	{
+		state.v = _mm512_xor_si512( state.v, _mm512_slli_epi32( state.v, 13 ) );
+		state.v = _mm512_xor_si512( state.v, _mm512_srli_epi32( state.v, 17 ) );
+		state.v = _mm512_xor_si512( state.v, _mm512_slli_epi32( state.v, 5 ) );
+		return state;
+	}
+	floatx16 NextFloat16() { return _mm512_mul_ps( _mm512_cvtepi32_ps( _mm512_srli_epi32( NextUInt16().v, 8 ) ), _mm512_set1_ps( 1.0f / 16777216 ) ); }
+#else
+	uintx16 NextUInt16() { RandomX8::Step( state.lo ), RandomX8::Step( state.hi ); return state; }
+	floatx16 NextFloat16() { NextUInt16(); return floatx16( RandomX8::ToFloat( state.lo ), RandomX8::ToFloat( state.hi ) ); }
+#endif
+	floatx16 Rand16( const floatx16& range ) { return NextFloat16() * range; }
+private:
+	uintx16 state;
+};
+
 // Perlin noise
-float noise2D( const float x, const float y );
\ No newline at end of file
+float noise2D( const float x, const float y );
+// batched: count samples at (x[i], y[i]); eight at a time on AVX2
+void noise2D( const float* x, const float* y, float* out, const int count );
+// width x height samples on a lattice starting at (x0, y0), dx and dy apart, row by row
+void noise2DField( float* out, const int width, const int height, const float x0, const float y0, const float dx, const float dy, const bool parallel = true );
\ No newline at end of file